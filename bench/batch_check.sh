@@ -0,0 +1,172 @@
+#!/bin/bash
+# Check how arguments are split into batches (see "make check-batches").
+#
+# usage: batch_check.sh [XOPEN]
+#
+# A tree of BATCH_FILES files is given to xopen with -r, once without
+# -P (programs in background) and once with -P 4. Half the files go to
+# a program, half to a function of ~/.bashrc; both only record the
+# arguments they get. The check fails if:
+#   - a file of the tree did not reach a command, or reached one more
+#     than once,
+#   - a batch (command, arguments and their pointers) is bigger than
+#     the budget xopen computes (getArgumentBudget in main.cpp).
+#
+# Settings (environment):
+#   BENCH_DIR    Where the tree is made (/tmp/xopen-bench).
+#   BATCH_FILES  Number of files of the tree (100000).
+
+set -u
+
+XOPEN=$(realpath "${1:-../xopen}")
+BENCH_DIR=${BENCH_DIR:-/tmp/xopen-bench}
+BATCH_FILES=${BATCH_FILES:-100000}
+
+# Files per directory.
+FILES_PER_DIRECTORY=1000
+
+if [ ! -x "$XOPEN" ]; then
+	echo "batch_check.sh: $XOPEN: not an executable, run make first." >&2
+	exit 1
+fi
+
+mkdir -p "$BENCH_DIR" || exit 1
+BENCH_DIR=$(realpath "$BENCH_DIR")
+
+CHECK_DIR=$BENCH_DIR/batch-check
+CALLS=$CHECK_DIR/calls
+
+rm -rf "$CHECK_DIR"
+mkdir -p "$CHECK_DIR/home" "$CHECK_DIR/cache" "$CHECK_DIR/run" "$CHECK_DIR/config" "$CHECK_DIR/bin" "$CALLS"
+chmod 700 "$CHECK_DIR/run"
+
+## Tree.
+
+# Long names, so batches are full well before the last file.
+TREE=$BENCH_DIR/batch-tree-$BATCH_FILES
+
+if [ ! -d "$TREE" ]; then
+	echo "batch_check.sh: making $TREE..." >&2
+
+	for ((first = 0; first < BATCH_FILES; first += FILES_PER_DIRECTORY)); do
+		directory=$TREE.tmp/directory_$((first / FILES_PER_DIRECTORY))
+		names=()
+
+		mkdir -p "$directory"
+
+		for ((i = first; (i < first + FILES_PER_DIRECTORY) && (i < BATCH_FILES); ++i)); do
+			if ((i % 2)); then
+				names+=("$directory/file_with_a_rather_long_name_$i.txt")
+			else
+				names+=("$directory/file_with_a_rather_long_name_$i.pdf")
+			fi
+		done
+
+		touch "${names[@]}"
+	done
+
+	mv "$TREE.tmp" "$TREE"
+fi
+
+find "$TREE" -type f | sort > "$CHECK_DIR/expected"
+
+## Commands.
+
+# Each call writes its command and arguments (nul-separated) to a file
+# of its own.
+cat > "$CHECK_DIR/bin/xopenrecord" << 'EOF'
+#!/bin/sh
+printf '%s\0' xopenrecord "$@" > "$(mktemp "$CALLS/program.XXXXXX")"
+EOF
+chmod +x "$CHECK_DIR/bin/xopenrecord"
+
+cat > "$CHECK_DIR/home/.bashrc" << 'EOF'
+xopenrecordfn()
+{
+	printf '%s\0' xopenrecordfn "$@" > "$(mktemp "$CALLS/function.XXXXXX")"
+}
+EOF
+
+cat > "$CHECK_DIR/config/xopen.conf" << EOF
+xopenrecord - pdf
+xopenrecordfn - txt
+EOF
+
+# NOTE: Only these variables: the budget depends on the environment,
+#       and is computed below from the same one.
+ENVIRONMENT=(HOME="$CHECK_DIR/home" XDG_CACHE_HOME="$CHECK_DIR/cache" XDG_RUNTIME_DIR="$CHECK_DIR/run"
+			 XDG_CONFIG_HOME="$CHECK_DIR/config" PATH="$CHECK_DIR/bin:/usr/bin:/bin" CALLS="$CALLS")
+
+# Same computation as getArgumentBudget (8-byte pointers).
+environmentSize=$(env -i "${ENVIRONMENT[@]}" env -0 | tr '\0' '\n' | awk '{size += length($0) + 1 + 8} END {print size + 8}')
+BUDGET=$(($(getconf ARG_MAX) - environmentSize - 2048 - 8))
+
+## Check.
+
+failed=0
+
+# check NAME XOPEN_OPTIONS...
+check()
+{
+	local name=$1
+	shift
+
+	rm -f "$CALLS"/*
+
+	# Every command inherits the lock file (shared lock): taking it
+	# exclusively waits for programs left running in background.
+	(
+		flock -s 9
+		env -i "${ENVIRONMENT[@]}" "$XOPEN" --no-daemon "$@" -r "$TREE" > /dev/null 2> "$CHECK_DIR/stderr"
+	) 9> "$CHECK_DIR/lock"
+
+	flock -x "$CHECK_DIR/lock" true
+
+	local batchCount=0 largest=0 size call
+
+	for call in "$CALLS"/*; do
+		[ -f "$call" ] || continue
+
+		size=$(tr '\0' '\n' < "$call" | awk '{size += length($0) + 1 + 8} END {print size}')
+		((batchCount += 1))
+		((size > largest)) && largest=$size
+
+		if ((size > BUDGET)); then
+			echo "batch_check.sh: $name: $(basename "$call"): $size bytes, over the budget ($BUDGET)." >&2
+			failed=1
+		fi
+	done
+
+	# Arguments only (not the command).
+	for call in "$CALLS"/*; do
+		[ -f "$call" ] && tr '\0' '\n' < "$call" | tail -n +2
+	done | sort > "$CHECK_DIR/got"
+
+	local missing duplicated
+	missing=$(comm -23 "$CHECK_DIR/expected" <(sort -u "$CHECK_DIR/got") | wc -l)
+	duplicated=$(uniq -d "$CHECK_DIR/got" | wc -l)
+
+	if ((missing || duplicated)); then
+		echo "batch_check.sh: $name: $missing files missing, $duplicated given more than once." >&2
+		failed=1
+	fi
+
+	if [ -s "$CHECK_DIR/stderr" ]; then
+		echo "batch_check.sh: $name: xopen said:" >&2
+		head -5 "$CHECK_DIR/stderr" >&2
+		failed=1
+	fi
+
+	printf 'batch_check.sh: %-10s %d files in %d batches (largest: %d of %d bytes).\n' \
+		   "$name" "$(wc -l < "$CHECK_DIR/got")" "$batchCount" "$largest" "$BUDGET" >&2
+}
+
+check background
+check -P4 -P 4
+
+if ((failed)); then
+	echo "batch_check.sh: FAILED." >&2
+	exit 1
+fi
+
+echo "batch_check.sh: OK." >&2
@@ -0,0 +1,427 @@
+#!/bin/bash
+# Time xopen on generated trees and configs (see "make bench").
+#
+# usage: bench.sh [XOPEN]
+#
+# Everything is generated under BENCH_DIR, the same way each time, and
+# programs are replaced by a stub which does nothing: only xopen's own
+# work is timed (parsing the config, walking, classifying, launching).
+# Results go to BENCH_OUT/results.csv and BENCH_OUT/results.json, one
+# row per case, so runs of different versions can be compared.
+#
+# Settings (environment):
+#   BENCH_DIR         Where trees and configs are made (/tmp/xopen-bench).
+#   BENCH_OUT         Where results are written (../build/bench).
+#   BENCH_DEPTH       Depth of the tree (3).
+#   BENCH_FANOUT      Sub-directories per directory (8).
+#   BENCH_FILES       Files per directory (40).
+#   BENCH_EXTENSIONS  Extension of the files, in turn. Repeat one to make
+#                     it more common. "-" for no extension.
+#                     ("pdf pdf jpg jpg png mp4 txt c md dat -")
+#   BENCH_RULES       Sizes of the generated configs, in extensions
+#                     (10 100 1000 10000).
+#   BENCH_RUNS        Timed runs per case, the median is kept (5).
+#   BENCH_JOBS        Threads for the -j cases (number of CPUs).
+#   BENCH_COPIES      Times the tree is given to the classify_scaling
+#                     case, for more entries (8).
+#   BENCH_LAUNCHES    Commands of the launch_rate config, each run once
+#                     per run (256).
+
+set -u
+
+XOPEN=$(realpath "${1:-../xopen}")
+BENCH_DIR=${BENCH_DIR:-/tmp/xopen-bench}
+BENCH_OUT=${BENCH_OUT:-../build/bench}
+BENCH_DEPTH=${BENCH_DEPTH:-3}
+BENCH_FANOUT=${BENCH_FANOUT:-8}
+BENCH_FILES=${BENCH_FILES:-40}
+BENCH_EXTENSIONS=${BENCH_EXTENSIONS:-pdf pdf jpg jpg png mp4 txt c md dat -}
+BENCH_RULES=${BENCH_RULES:-10 100 1000 10000}
+BENCH_RUNS=${BENCH_RUNS:-5}
+BENCH_JOBS=${BENCH_JOBS:-$(nproc 2>/dev/null || echo 4)}
+BENCH_COPIES=${BENCH_COPIES:-8}
+BENCH_LAUNCHES=${BENCH_LAUNCHES:-256}
+
+# Extensions of the tree which have a rule ("dat" and "-" do not, they
+# are sniffed).
+KNOWN_EXTENSIONS="pdf jpg png mp4 mkv txt c h md"
+# NOTE: Rules are grouped in lines of EXTENSIONS_PER_LINE extensions,
+#       like a hand written config. Commands are made of letters and
+#       digits only.
+EXTENSIONS_PER_LINE=250
+
+if [ ! -x "$XOPEN" ]; then
+	echo "bench.sh: $XOPEN: not an executable, run make first." >&2
+	exit 1
+fi
+
+VERSION=$(git -C "$(dirname "$0")" describe --always --dirty 2>/dev/null || echo unknown)
+
+mkdir -p "$BENCH_DIR" "$BENCH_OUT" || exit 1
+BENCH_DIR=$(realpath "$BENCH_DIR")
+
+# Nothing from the user's setup: no config, cache, functions or daemon.
+export HOME=$BENCH_DIR/home
+export XDG_CACHE_HOME=$BENCH_DIR/cache
+export XDG_RUNTIME_DIR=$BENCH_DIR/run
+export PATH=$BENCH_DIR/bin:/usr/bin:/bin
+
+rm -rf "$HOME" "$XDG_CACHE_HOME" "$XDG_RUNTIME_DIR" "$BENCH_DIR/bin"
+mkdir -p "$HOME" "$XDG_CACHE_HOME" "$XDG_RUNTIME_DIR" "$BENCH_DIR/bin"
+touch "$HOME/.bashrc"
+chmod 700 "$XDG_RUNTIME_DIR"
+
+printf '#!/bin/sh\nexit 0\n' > "$BENCH_DIR/bin/xopenstub"
+chmod +x "$BENCH_DIR/bin/xopenstub"
+
+## Tree.
+
+read -r -a extensions <<< "$BENCH_EXTENSIONS"
+fileCount=0
+
+# makeDirectory PATH DEPTH
+makeDirectory()
+{
+	local directory=$1 depth=$2
+	local names=() i extension
+
+	mkdir -p "$directory"
+
+	for ((i = 0; i < BENCH_FILES; ++i)); do
+		extension=${extensions[(fileCount + i) % ${#extensions[@]}]}
+
+		if [ "$extension" = "-" ]; then
+			names+=("$directory/file_$i")
+		else
+			names+=("$directory/file_$i.$extension")
+		fi
+	done
+
+	((fileCount += BENCH_FILES))
+
+	if ((${#names[@]})); then
+		touch "${names[@]}"
+	fi
+
+	if ((depth < BENCH_DEPTH)); then
+		for ((i = 0; i < BENCH_FANOUT; ++i)); do
+			makeDirectory "$directory/directory_$i" $((depth + 1))
+		done
+	fi
+}
+
+TREE=$BENCH_DIR/tree-$BENCH_DEPTH-$BENCH_FANOUT-$BENCH_FILES-$(echo "$BENCH_EXTENSIONS" | cksum | cut -d' ' -f1)
+
+if [ ! -d "$TREE" ]; then
+	echo "bench.sh: making $TREE..." >&2
+	makeDirectory "$TREE.tmp" 0
+	mv "$TREE.tmp" "$TREE"
+fi
+
+fileCount=$(find "$TREE" -type f | wc -l)
+PROBE=$TREE/file_0.${extensions[0]}
+[ "${extensions[0]}" = "-" ] && PROBE=$TREE/file_0
+
+## Configs.
+
+# makeConfig DIRECTORY RULE_COUNT
+makeConfig()
+{
+	local directory=$1 ruleCount=$2
+	local rules=($KNOWN_EXTENSIONS) i
+
+	for ((i = ${#rules[@]}; i < ruleCount; ++i)); do
+		rules+=("$(printf 'x%05d' "$i")")
+	done
+
+	mkdir -p "$directory"
+
+	{
+		for ((i = 0; i < ruleCount; i += EXTENSIONS_PER_LINE)); do
+			echo "# Extensions $i to $((i + EXTENSIONS_PER_LINE - 1))."
+			echo "xopenstub - ${rules[*]:i:EXTENSIONS_PER_LINE}"
+		done
+	} > "$directory/xopen.conf"
+
+	rm -f "$directory/xopen.conf.cache"
+}
+
+for rules in $BENCH_RULES; do
+	makeConfig "$BENCH_DIR/config-$rules" "$rules"
+done
+
+# Launch rate: one command (a link to the stub) and one file per
+# extension, so each run starts BENCH_LAUNCHES programs.
+LAUNCH_DIR=$BENCH_DIR/launch-$BENCH_LAUNCHES
+launchFiles=()
+
+rm -rf "$LAUNCH_DIR"
+mkdir -p "$LAUNCH_DIR/config"
+
+for ((i = 0; i < BENCH_LAUNCHES; ++i)); do
+	ln -s xopenstub "$BENCH_DIR/bin/xopenstub$i"
+	echo "xopenstub$i - l$i"
+	launchFiles+=("$LAUNCH_DIR/file.l$i")
+done > "$LAUNCH_DIR/config/xopen.conf"
+
+touch "${launchFiles[@]}"
+
+## Timing.
+
+CSV=$BENCH_OUT/results.csv
+JSON=$BENCH_OUT/results.json
+
+echo "version,case,rules,files,jobs,io_depth,runs,median_ms,min_ms,max_ms,mb_per_s,spawns_per_s" > "$CSV"
+jsonRows=()
+
+# now: nanoseconds.
+now()
+{
+	date +%s%N
+}
+
+# measure CASE RULES JOBS IO_DEPTH ARGUMENTS...
+# xopen's stdin is MEASURE_INPUT (/dev/null).
+measure()
+{
+	local name=$1 rules=$2 jobs=$3 ioDepth=$4
+	shift 4
+
+	local times=() run start end
+
+	export XDG_CONFIG_HOME=$BENCH_DIR/config-$rules
+
+	local input=${MEASURE_INPUT:-/dev/null}
+
+	# Warm up (page cache, config and command caches).
+	"$XOPEN" "$@" < "$input" > /dev/null 2>&1
+
+	for ((run = 0; run < BENCH_RUNS; ++run)); do
+		start=$(now)
+		"$XOPEN" "$@" < "$input" > /dev/null 2>&1
+		end=$(now)
+		times+=($(((end - start) / 1000)))
+	done
+
+	addRow "$name" "$rules" "$jobs" "$ioDepth" "" "" "${times[@]}"
+}
+
+# addRow CASE RULES JOBS IO_DEPTH MB_PER_S SPAWNS_PER_S TIMES...
+# TIMES are in microseconds, MB_PER_S and SPAWNS_PER_S can be empty.
+addRow()
+{
+	local name=$1 rules=$2 jobs=$3 ioDepth=$4 throughput=$5 spawnRate=$6
+	shift 6
+
+	local sorted=($(printf '%s\n' "$@" | sort -n))
+	local median=${sorted[$(($# / 2))]}
+	local min=${sorted[0]}
+	local max=${sorted[$(($# - 1))]}
+
+	# Microseconds to milliseconds.
+	median=$(printf '%d.%03d' $((median / 1000)) $((median % 1000)))
+	min=$(printf '%d.%03d' $((min / 1000)) $((min % 1000)))
+	max=$(printf '%d.%03d' $((max / 1000)) $((max % 1000)))
+
+	echo "$VERSION,$name,$rules,$fileCount,$jobs,$ioDepth,$#,$median,$min,$max,$throughput,$spawnRate" >> "$CSV"
+	jsonRows+=("$(printf '{"version": "%s", "case": "%s", "rules": %d, "files": %d, "jobs": %d, "io_depth": %d, "runs": %d, "median_ms": %s, "min_ms": %s, "max_ms": %s, "mb_per_s": %s, "spawns_per_s": %s}' \
+						 "$VERSION" "$name" "$rules" "$fileCount" "$jobs" "$ioDepth" "$#" "$median" "$min" "$max" "${throughput:-null}" "${spawnRate:-null}")")
+
+	printf '%-12s rules: %-6d jobs: %-3d io-depth: %-3d %10s ms%s%s\n' "$name" "$rules" "$jobs" "$ioDepth" "$median" \
+		   "${throughput:+ ($throughput MB/s)}" "${spawnRate:+ ($spawnRate spawns/s)}" >&2
+}
+
+# measureParsing RULES
+# Only the time spent parsing the config, from --profile.
+measureParsing()
+{
+	local rules=$1
+	local profileFile=$BENCH_DIR/profile.json
+	local times=() run bytes=0 time
+
+	export XDG_CONFIG_HOME=$BENCH_DIR/config-$rules
+
+	for ((run = 0; run < BENCH_RUNS; ++run)); do
+		rm -f "$profileFile"
+		"$XOPEN" --no-daemon --rebuild-cache --profile="$profileFile" -w "$PROBE" > /dev/null 2>&1
+
+		if [ ! -f "$profileFile" ]; then
+			echo "bench.sh: xopen was built without --profile, skipping parse_rate." >&2
+			return
+		fi
+
+		# Milliseconds with 3 decimals, to microseconds.
+		time=$(sed -n 's/.*"config_parse": {"ms": \([0-9]*\)\.\([0-9]*\).*/\1\2/p' "$profileFile")
+		bytes=$(sed -n 's/.*"config_bytes_parsed": \([0-9]*\).*/\1/p' "$profileFile")
+		times+=($((10#$time)))
+	done
+
+	local sorted=($(printf '%s\n' "${times[@]}" | sort -n))
+	local median=${sorted[$((BENCH_RUNS / 2))]}
+
+	# Bytes per microsecond are MB/s.
+	addRow parse_rate "$rules" 1 64 "$(awk "BEGIN {printf \"%.1f\", $bytes / ($median ? $median : 1)}")" "" "${times[@]}"
+}
+
+# measureClassifying RULES JOBS
+# Only the time spent classifying the entries of the tree, given
+# BENCH_COPIES times, from --profile. Files without a rule are sniffed,
+# as by default.
+measureClassifying()
+{
+	local rules=$1 jobs=$2
+	local profileFile=$BENCH_DIR/profile.json
+	local times=() run time copies=()
+
+	export XDG_CONFIG_HOME=$BENCH_DIR/config-$rules
+
+	for ((run = 0; run < BENCH_COPIES; ++run)); do
+		copies+=("$TREE")
+	done
+
+	for ((run = 0; run < BENCH_RUNS; ++run)); do
+		rm -f "$profileFile"
+		"$XOPEN" --no-daemon -j "$jobs" --profile="$profileFile" -w -r "${copies[@]}" > /dev/null 2>&1
+
+		if [ ! -f "$profileFile" ]; then
+			echo "bench.sh: xopen was built without --profile, skipping classify_scaling." >&2
+			return
+		fi
+
+		time=$(sed -n 's/.*"classify": {"ms": \([0-9]*\)\.\([0-9]*\).*/\1\2/p' "$profileFile")
+		times+=($((10#$time)))
+	done
+
+	# Rows count every copy.
+	local fileCount=$((fileCount * BENCH_COPIES))
+
+	addRow classify_scaling "$rules" "$jobs" 64 "" "" "${times[@]}"
+}
+
+# measureLaunching MAX_PROCS
+# Programs started per second of a whole run (spawns of --stats), with
+# -P MAX_PROCS (0: started in background, not waited for).
+measureLaunching()
+{
+	local maxProcs=$1
+	local times=() rates=() run start end spawns options=()
+
+	export XDG_CONFIG_HOME=$LAUNCH_DIR/config
+
+	((maxProcs)) && options=(-P "$maxProcs")
+
+	# Warm up (config and command caches).
+	"$XOPEN" --no-daemon "${options[@]}" "${launchFiles[@]}" > /dev/null 2>&1
+
+	for ((run = 0; run < BENCH_RUNS; ++run)); do
+		start=$(now)
+		spawns=$("$XOPEN" --no-daemon --stats "${options[@]}" "${launchFiles[@]}" 2>&1 > /dev/null |
+					 sed -n 's/.*spawn: \([0-9]*\).*/\1/p')
+		end=$(now)
+		times+=($(((end - start) / 1000)))
+		rates+=($((${spawns:-0} * 1000000000 / (end - start))))
+	done
+
+	local sorted=($(printf '%s\n' "${rates[@]}" | sort -n))
+	local fileCount=$BENCH_LAUNCHES
+
+	addRow launch_rate 1 "$maxProcs" 64 "" "${sorted[$((BENCH_RUNS / 2))]}" "${times[@]}"
+}
+
+smallest=$(echo $BENCH_RULES | cut -d' ' -f1)
+largest=$(echo $BENCH_RULES | rev | cut -d' ' -f1 | rev)
+
+echo "bench.sh: $fileCount files, $BENCH_RUNS runs per case." >&2
+
+# Parse: the config is parsed again each time, for one file.
+for rules in $BENCH_RULES; do
+	measure parse "$rules" 1 64 --no-daemon --rebuild-cache -w "$PROBE"
+done
+
+# Parse rate: makeInstructionsFromConfig alone, in MB/s.
+for rules in $BENCH_RULES; do
+	measureParsing "$rules"
+done
+
+# Load: the config's cache is used.
+for rules in $BENCH_RULES; do
+	measure load "$rules" 1 64 --no-daemon -w "$PROBE"
+done
+
+# Daemon: same, but the config is already loaded by the daemon.
+XDG_CONFIG_HOME=$BENCH_DIR/config-$largest "$XOPEN" --daemon 2> /dev/null &
+daemonPid=$!
+
+for ((i = 0; i < 50; ++i)); do
+	[ -S "$XDG_RUNTIME_DIR/xopen.sock" ] && break
+	sleep 0.1
+done
+
+if [ -S "$XDG_RUNTIME_DIR/xopen.sock" ]; then
+	measure daemon "$largest" 1 64 -w "$PROBE"
+else
+	echo "bench.sh: the daemon did not start, skipping it." >&2
+fi
+
+kill "$daemonPid" 2> /dev/null
+wait "$daemonPid" 2> /dev/null
+
+# Walk: the whole tree, with 1 to BENCH_JOBS threads (same entries
+# whatever their number).
+for ((jobs = 1; jobs < BENCH_JOBS; jobs *= 2)); do
+	measure walk "$smallest" "$jobs" 64 --no-daemon --no-sniff -j "$jobs" -w -r "$TREE"
+done
+
+measure walk "$smallest" "$BENCH_JOBS" 64 --no-daemon --no-sniff -j "$BENCH_JOBS" -w -r "$TREE"
+
+# Classify: every file of the tree, against each config.
+for rules in $BENCH_RULES; do
+	measure classify "$rules" 1 64 --no-daemon --no-sniff -w -r "$TREE"
+done
+
+# Classify scaling: the classification alone, with 1 to BENCH_JOBS
+# threads (same output whatever their number).
+for ((jobs = 1; jobs < BENCH_JOBS; jobs *= 2)); do
+	measureClassifying "$largest" "$jobs"
+done
+
+measureClassifying "$largest" "$BENCH_JOBS"
+
+# Sniff: files without a rule are read, one after the other or with
+# io_uring.
+for ioDepth in 0 64; do
+	measure sniff "$smallest" 1 "$ioDepth" --no-daemon --io-depth "$ioDepth" -w -r "$TREE"
+done
+
+# Stat: every entry of the tree on stdin (-0), so each one is stat'ed
+# (whether it is a directory changes its command), one after the other
+# or by batches with io_uring.
+ENTRIES=$BENCH_DIR/entries-$(basename "$TREE")
+find "$TREE" -mindepth 1 -print0 > "$ENTRIES"
+
+for ioDepth in 0 64; do
+	MEASURE_INPUT=$ENTRIES measure stat "$smallest" 1 "$ioDepth" --no-daemon --no-sniff --io-depth "$ioDepth" -w -0
+done
+
+# Launch: the stub is run for every batch of files, and waited for.
+measure launch "$smallest" 1 64 --no-daemon --no-sniff -P 4 -r "$TREE"
+
+# Launch rate: BENCH_LAUNCHES programs of one file each, in background
+# and waited for (the jobs column is -P).
+for maxProcs in 0 1 4; do
+	measureLaunching "$maxProcs"
+done
+
+{
+	echo "["
+	for ((i = 0; i < ${#jsonRows[@]}; ++i)); do
+		if ((i + 1 < ${#jsonRows[@]})); then
+			echo "  ${jsonRows[i]},"
+		else
+			echo "  ${jsonRows[i]}"
+		fi
+	done
+	echo "]"
+} > "$JSON"
+
+echo "bench.sh: results in $CSV and $JSON." >&2
@@ -0,0 +1,237 @@
+// Time matching file names to extensions (see "make bench"), on
+// generated names:
+//   - the linear scan of every extension of every rule xopen did
+//     before the instruction index, against one index lookup (both on
+//     what follows the last dot),
+//   - the last dot extraction xopen used to do (+ index lookup),
+//     against the extension trie (see extension_trie.h).
+//
+// usage: match_bench [NAME_COUNT]   (1000000)
+
+#include "ef_utils.h"
+#include "instruction_table.h"
+#include "instruction_index.h"
+#include "extension_trie.h"
+
+#include <time.h>
+
+static u64 getTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (u64) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Extension after the last dot of the name (NULL if none).
+static char *getLastDotExtension(char *path, size_t pathLength)
+{
+	char *at = path + pathLength;
+
+	while ((at > path) &&
+		   (at[-1] != '.') &&
+		   (at[-1] != '/'))
+	{
+		--at;
+	}
+
+	if ((at == path) ||
+		(at[-1] == '/'))
+	{
+		return NULL;
+	}
+
+	return at;
+}
+
+// What getInstructionByExtension did before the index: every extension
+// of every rule, in config order.
+static Instruction *matchScan(InstructionTable *table, char *path, size_t pathLength)
+{
+	char *extension = getLastDotExtension(path, pathLength);
+
+	if (!extension)
+	{
+		return NULL;
+	}
+
+	size_t extensionLength = path + pathLength - extension;
+
+	for (u32 i = 0; i < table->instructionCount; ++i)
+	{
+		Instruction *instruction = table->instructions + i;
+
+		for (u32 extensionIndex = instruction->extensionFirst;
+			 extensionIndex < instruction->extensionFirst + instruction->extensionCount;
+			 ++extensionIndex)
+		{
+			StringRef ref = table->extensions[extensionIndex];
+
+			if ((ref.length == extensionLength) &&
+				(memcmp(getString(table, ref), extension, extensionLength) == 0))
+			{
+				return instruction;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+// What getFileExtension did before the trie.
+static Instruction *matchLastDot(InstructionIndex *index, char *path, size_t pathLength)
+{
+	char *extension = getLastDotExtension(path, pathLength);
+
+	return extension
+		? getInstructionByExtension(index, extension, path + pathLength - extension)
+		: NULL;
+}
+
+// What getFileExtension does now.
+static Instruction *matchTrie(InstructionIndex *index, ExtensionTrie *trie, char *path, size_t pathLength)
+{
+	StringRef *match = matchExtension(trie, path, pathLength);
+
+	return match
+		? getInstructionByExtension(index, getString(trie->table, *match), match->length)
+		: matchLastDot(index, path, pathLength);
+}
+
+// Same extensions as the configs of bench.sh, + a few patterns.
+static void makeTable(InstructionTable *table, u32 ruleCount)
+{
+	char *known[] = {"pdf", "jpg", "png", "mp4", "mkv", "txt", "c", "h", "md"};
+	char *patterns[] = {"tar.gz", "tar.xz", "*.min.js", "*rc", "Dockerfile*", "Makefile*"};
+	char text[64];
+
+	initInstructionTable(table);
+
+	for (u32 i = 0; i < ruleCount; ++i)
+	{
+		if ((i % 250) == 0)
+		{
+			addInstruction(table, internString(table, "xopenstub", 9));
+		}
+
+		if (i < ARRAY_SIZE(known))
+		{
+			addExtension(table, internString(table, known[i], strlen(known[i])));
+		}
+		else
+		{
+			int length = sprintf(text, "x%05u", i);
+			addExtension(table, internString(table, text, length));
+		}
+	}
+
+	addInstruction(table, internString(table, "patterns", 8));
+
+	for (u32 i = 0; i < ARRAY_SIZE(patterns); ++i)
+	{
+		addExtension(table, internString(table, patterns[i], strlen(patterns[i])));
+	}
+
+	finishInstructionTable(table);
+}
+
+int main(int argc, char **argv)
+{
+	u32 nameCount = (argc > 1) ? (u32) atoi(argv[1]) : 1000000;
+
+	char *suffixes[] = {".pdf", ".jpg", ".png", ".tar.gz", ".min.js", ".js", ".dat", "", ".bashrc",
+						".x00042", ".x09999", ".c", ".md", ".cache.txt"};
+
+	// All names in one buffer, like an EntryList.
+	char *names = (char *) malloc((size_t) nameCount * 64);
+	u32 *nameOffsets = (u32 *) malloc(nameCount * sizeof(u32));
+	u8 *nameLengths = (u8 *) malloc(nameCount);
+	ASSERT(names && nameOffsets && nameLengths);
+
+	u32 size = 0;
+	u32 seed = 1;
+
+	for (u32 i = 0; i < nameCount; ++i)
+	{
+		seed = seed * 1103515245u + 12345u;
+
+		char *suffix = suffixes[(seed >> 16) % ARRAY_SIZE(suffixes)];
+		int length = ((seed >> 8) % 16 == 0)
+			? sprintf(names + size, "dir%u/sub/Dockerfile%s", i % 97, suffix)
+			: sprintf(names + size, "dir%u/sub/file%u%s", i % 97, i, suffix);
+
+		nameOffsets[i] = size;
+		nameLengths[i] = (u8) length;
+		size += length + 1;
+	}
+
+	u32 ruleCounts[] = {10, 100, 1000, 10000};
+
+	printf("match_bench: %u names.\n", nameCount);
+
+	for (u32 r = 0; r < ARRAY_SIZE(ruleCounts); ++r)
+	{
+		InstructionTable table;
+		InstructionIndex index;
+		ExtensionTrie trie;
+
+		makeTable(&table, ruleCounts[r]);
+		buildInstructionIndex(&index, &table);
+		buildExtensionTrie(&trie, &table, &index);
+
+		// Matched names are counted so nothing is optimized out.
+		u32 scanMatches = 0,
+			lastDotMatches = 0,
+			trieMatches = 0;
+
+		// NOTE: The scan costs up to ruleCounts[r] comparisons a name,
+		//       fewer names keep it to a few seconds.
+		u32 scanCount = MIN(nameCount, 200000000u / ruleCounts[r]);
+
+		u64 start = getTime();
+
+		for (u32 i = 0; i < scanCount; ++i)
+		{
+			scanMatches += (matchScan(&table, names + nameOffsets[i], nameLengths[i]) != NULL);
+		}
+
+		u64 scanTime = getTime() - start;
+
+		start = getTime();
+
+		for (u32 i = 0; i < nameCount; ++i)
+		{
+			lastDotMatches += (matchLastDot(&index, names + nameOffsets[i], nameLengths[i]) != NULL);
+		}
+
+		u64 lastDotTime = getTime() - start;
+
+		start = getTime();
+
+		for (u32 i = 0; i < nameCount; ++i)
+		{
+			trieMatches += (matchTrie(&index, &trie, names + nameOffsets[i], nameLengths[i]) != NULL);
+		}
+
+		u64 trieTime = getTime() - start;
+
+		printf("lookup     rules: %-6u scan: %9.1f ns/name (%u of %u matched)  index: %6.1f ns/name (%u matched)\n",
+			   ruleCounts[r],
+			   (double) scanTime / scanCount, scanMatches, scanCount,
+			   (double) lastDotTime / nameCount, lastDotMatches);
+		printf("match      rules: %-6u last-dot: %6.1f ns/name (%u matched)  trie: %6.1f ns/name (%u matched)\n",
+			   ruleCounts[r],
+			   (double) lastDotTime / nameCount, lastDotMatches,
+			   (double) trieTime / nameCount, trieMatches);
+
+		freeExtensionTrie(&trie);
+		freeInstructionIndex(&index);
+		freeInstructionTable(&table);
+	}
+
+	free(names);
+	free(nameOffsets);
+	free(nameLengths);
+
+	return 0;
+}
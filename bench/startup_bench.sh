@@ -0,0 +1,169 @@
+#!/bin/bash
+# Time the startup of xopen with a baked config (see "make baked")
+# against the same config read at runtime (see "make bench-startup").
+#
+# usage: startup_bench.sh [XOPEN]
+#
+# For each config size, one file is classified with -w by:
+#   parsed   xopen, the config is parsed again (--rebuild-cache).
+#   cached   xopen, from the config's cache.
+#   baked    xopen-baked made from that config (nothing to load).
+# Both the whole run and the loading of the config alone (config_load
+# of --profile) are timed. Results go to BENCH_OUT/startup.csv.
+#
+# Settings (environment):
+#   BENCH_DIR    Where configs and baked binaries are made
+#                (/tmp/xopen-bench).
+#   BENCH_OUT    Where results are written (../build/bench).
+#   BENCH_RULES  Sizes of the generated configs, in extensions
+#                (10 100 1000 10000).
+#   BENCH_RUNS   Timed runs per case, the median is kept (20).
+
+set -u
+
+XOPEN=$(realpath "${1:-../xopen}")
+CODE_DIR=$(realpath "$(dirname "$0")/../code")
+BENCH_DIR=${BENCH_DIR:-/tmp/xopen-bench}
+BENCH_OUT=${BENCH_OUT:-../build/bench}
+BENCH_RULES=${BENCH_RULES:-10 100 1000 10000}
+BENCH_RUNS=${BENCH_RUNS:-20}
+
+# Same configs as bench.sh.
+KNOWN_EXTENSIONS="pdf jpg png mp4 mkv txt c h md"
+EXTENSIONS_PER_LINE=250
+
+if [ ! -x "$XOPEN" ]; then
+	echo "startup_bench.sh: $XOPEN: not an executable, run make first." >&2
+	exit 1
+fi
+
+VERSION=$(git -C "$(dirname "$0")" describe --always --dirty 2>/dev/null || echo unknown)
+
+mkdir -p "$BENCH_DIR" "$BENCH_OUT" || exit 1
+BENCH_DIR=$(realpath "$BENCH_DIR")
+
+# Nothing from the user's setup: no config, cache, functions or daemon.
+export HOME=$BENCH_DIR/home
+export XDG_CACHE_HOME=$BENCH_DIR/cache
+export XDG_RUNTIME_DIR=$BENCH_DIR/run
+export PATH=$BENCH_DIR/bin:/usr/bin:/bin
+
+mkdir -p "$HOME" "$XDG_CACHE_HOME" "$XDG_RUNTIME_DIR" "$BENCH_DIR/bin"
+touch "$HOME/.bashrc"
+chmod 700 "$XDG_RUNTIME_DIR"
+
+printf '#!/bin/sh\nexit 0\n' > "$BENCH_DIR/bin/xopenstub"
+chmod +x "$BENCH_DIR/bin/xopenstub"
+
+PROBE=$BENCH_DIR/probe.pdf
+touch "$PROBE"
+
+# makeConfig DIRECTORY RULE_COUNT
+makeConfig()
+{
+	local directory=$1 ruleCount=$2
+	local rules=($KNOWN_EXTENSIONS) i
+
+	for ((i = ${#rules[@]}; i < ruleCount; ++i)); do
+		rules+=("$(printf 'x%05d' "$i")")
+	done
+
+	mkdir -p "$directory"
+
+	{
+		for ((i = 0; i < ruleCount; i += EXTENSIONS_PER_LINE)); do
+			echo "# Extensions $i to $((i + EXTENSIONS_PER_LINE - 1))."
+			echo "xopenstub - ${rules[*]:i:EXTENSIONS_PER_LINE}"
+		done
+	} > "$directory/xopen.conf"
+
+	rm -f "$directory/xopen.conf.cache"
+}
+
+CSV=$BENCH_OUT/startup.csv
+
+echo "version,case,rules,runs,median_ms,min_ms,max_ms,load_median_ms" > "$CSV"
+
+# now: microseconds, without starting a process (date would be most of
+# what is timed).
+now()
+{
+	local time=${EPOCHREALTIME/./}
+	echo $((10#$time))
+}
+
+# median MICROSECONDS...: in milliseconds.
+median()
+{
+	local sorted=($(printf '%s\n' "$@" | sort -n))
+	local median=${sorted[$(($# / 2))]}
+
+	printf '%d.%03d' $((median / 1000)) $((median % 1000))
+}
+
+# measure CASE RULES XOPEN ARGUMENTS...
+measure()
+{
+	local name=$1 rules=$2 xopen=$3
+	shift 3
+
+	local profileFile=$BENCH_DIR/profile.json
+	local times=() loadTimes=() run start end time
+
+	# Warm up (page cache, config and command caches).
+	"$xopen" "$@" > /dev/null 2>&1
+
+	for ((run = 0; run < BENCH_RUNS; ++run)); do
+		start=$(now)
+		"$xopen" "$@" > /dev/null 2>&1
+		end=$(now)
+		times+=($((end - start)))
+	done
+
+	for ((run = 0; run < BENCH_RUNS; ++run)); do
+		rm -f "$profileFile"
+		"$xopen" --profile="$profileFile" "$@" > /dev/null 2>&1
+
+		# Milliseconds with 3 decimals, to microseconds (none if
+		# built without --profile).
+		time=$(sed -n 's/.*"config_load": {"ms": \([0-9]*\)\.\([0-9]*\).*/\1\2/p' "$profileFile" 2> /dev/null)
+		[ -n "$time" ] && loadTimes+=($((10#$time)))
+	done
+
+	local sorted=($(printf '%s\n' "${times[@]}" | sort -n))
+	local min=${sorted[0]} max=${sorted[$((BENCH_RUNS - 1))]}
+	local load=null
+
+	min=$(printf '%d.%03d' $((min / 1000)) $((min % 1000)))
+	max=$(printf '%d.%03d' $((max / 1000)) $((max % 1000)))
+
+	if ((${#loadTimes[@]})); then
+		load=$(median "${loadTimes[@]}")
+	fi
+
+	echo "$VERSION,$name,$rules,$BENCH_RUNS,$(median "${times[@]}"),$min,$max,$load" >> "$CSV"
+	printf '%-8s rules: %-6d %10s ms (config load: %s ms)\n' "$name" "$rules" "$(median "${times[@]}")" "$load" >&2
+}
+
+for rules in $BENCH_RULES; do
+	config=$BENCH_DIR/startup-config-$rules
+	baked=$BENCH_DIR/xopen-baked-$rules
+
+	makeConfig "$config" "$rules"
+
+	if ! make -s -C "$CODE_DIR" baked CONFIG="$config/xopen.conf" > "$BENCH_DIR/make.log" 2>&1; then
+		cat "$BENCH_DIR/make.log" >&2
+		echo "startup_bench.sh: could not make the baked binary of $rules rules." >&2
+		exit 1
+	fi
+
+	cp "$CODE_DIR/../xopen-baked" "$baked"
+
+	export XDG_CONFIG_HOME=$config
+
+	measure parsed "$rules" "$XOPEN" --no-daemon --rebuild-cache -w "$PROBE"
+	measure cached "$rules" "$XOPEN" --no-daemon -w "$PROBE"
+	measure baked "$rules" "$baked" -w "$PROBE"
+done
+
+echo "startup_bench.sh: results in $CSV." >&2
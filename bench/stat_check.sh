@@ -0,0 +1,145 @@
+#!/bin/bash
+# Check that walking takes entry types from readdir instead of stat'ing
+# every entry (see "make check-stats").
+#
+# usage: stat_check.sh [XOPEN]
+#
+# Two directories of a tree of STAT_FILES files, one of them with a
+# trailing '/', and a file are given to xopen --stats, with -r and -R,
+# on 1 and 4 threads. The check fails if, from --stats:
+#   - stat'ed and avoided stats are not one per argument (only the
+#     arguments are stat'ed, and the one with a '/' is not),
+#   - types from readdir are not one per entry under the directories,
+#   - opendir is not one per directory walked.
+#
+# NOTE: The tree has no symlinks: they are stat'ed (followed), like
+#       entries readdir gives no type for.
+#
+# Settings (environment):
+#   BENCH_DIR   Where the tree is made (/tmp/xopen-bench).
+#   STAT_FILES  Number of files of the tree (20000).
+
+set -u
+
+XOPEN=$(realpath "${1:-../xopen}")
+BENCH_DIR=${BENCH_DIR:-/tmp/xopen-bench}
+STAT_FILES=${STAT_FILES:-20000}
+
+# Files per directory, and sub-directories per directory.
+FILES_PER_DIRECTORY=100
+FANOUT=4
+
+if [ ! -x "$XOPEN" ]; then
+	echo "stat_check.sh: $XOPEN: not an executable, run make first." >&2
+	exit 1
+fi
+
+mkdir -p "$BENCH_DIR" || exit 1
+BENCH_DIR=$(realpath "$BENCH_DIR")
+
+CHECK_DIR=$BENCH_DIR/stat-check
+
+rm -rf "$CHECK_DIR"
+mkdir -p "$CHECK_DIR/home" "$CHECK_DIR/cache" "$CHECK_DIR/run" "$CHECK_DIR/config"
+chmod 700 "$CHECK_DIR/run"
+touch "$CHECK_DIR/home/.bashrc"
+
+## Tree.
+
+# Directories numbered breadth first: directory_N/directory_(N*FANOUT+1)...
+TREE=$BENCH_DIR/stat-tree-$STAT_FILES
+
+if [ ! -d "$TREE" ]; then
+	echo "stat_check.sh: making $TREE..." >&2
+
+	extensions=(pdf txt jpg "")
+	directories=("$TREE.tmp/directory_0")
+
+	for ((first = 0, index = 0; first < STAT_FILES; first += FILES_PER_DIRECTORY, ++index)); do
+		directory=${directories[index]}
+		names=()
+
+		mkdir -p "$directory"
+
+		for ((i = 1; i <= FANOUT; ++i)); do
+			directories+=("$directory/directory_$((index * FANOUT + i))")
+		done
+
+		for ((i = first; (i < first + FILES_PER_DIRECTORY) && (i < STAT_FILES); ++i)); do
+			extension=${extensions[i % ${#extensions[@]}]}
+			names+=("$directory/file_$i${extension:+.$extension}")
+		done
+
+		touch "${names[@]}"
+	done
+
+	mkdir -p "$TREE.tmp/directory_x"
+	touch "$TREE.tmp/file.pdf"
+	mv "$TREE.tmp" "$TREE"
+fi
+
+# NOTE: directory_0 has the whole walked tree but for directory_x.
+ARGUMENTS=("$TREE/directory_0" "$TREE/directory_x/" "$TREE/file.pdf")
+ENTRY_COUNT=$(find "$TREE/directory_0" "$TREE/directory_x" -mindepth 1 | wc -l)
+DIRECTORY_COUNT=$(find "$TREE/directory_0" "$TREE/directory_x" -type d | wc -l)
+
+cat > "$CHECK_DIR/config/xopen.conf" << EOF
+true - pdf txt jpg
+EOF
+
+ENVIRONMENT=(HOME="$CHECK_DIR/home" XDG_CACHE_HOME="$CHECK_DIR/cache" XDG_RUNTIME_DIR="$CHECK_DIR/run"
+			 XDG_CONFIG_HOME="$CHECK_DIR/config" PATH="/usr/bin:/bin")
+
+## Check.
+
+failed=0
+
+# check NAME XOPEN_OPTIONS...
+check()
+{
+	local name=$1
+	shift
+
+	local stats statCount avoidedCount readdirCount opendirCount
+
+	stats=$(env -i "${ENVIRONMENT[@]}" "$XOPEN" --no-daemon --stats -w "$@" "${ARGUMENTS[@]}" 2>&1 > /dev/null |
+				grep '^xopen: stat: ')
+
+	statCount=$(sed -n 's/.*stat: \([0-9]*\).*/\1/p' <<< "$stats")
+	avoidedCount=$(sed -n 's/.*avoided: \([0-9]*\).*/\1/p' <<< "$stats")
+	readdirCount=$(sed -n 's/.*type from readdir: \([0-9]*\).*/\1/p' <<< "$stats")
+	opendirCount=$(sed -n 's/.*opendir: \([0-9]*\).*/\1/p' <<< "$stats")
+
+	if [ -z "$statCount" ]; then
+		echo "stat_check.sh: $name: no --stats line from xopen." >&2
+		failed=1
+		return
+	fi
+
+	if ((statCount + avoidedCount != ${#ARGUMENTS[@]})) || ((avoidedCount != 1)); then
+		echo "stat_check.sh: $name: $statCount stat (avoided: $avoidedCount) for ${#ARGUMENTS[@]} arguments" \
+			 "and $ENTRY_COUNT entries." >&2
+		failed=1
+	fi
+
+	if ((readdirCount != ENTRY_COUNT)) || ((opendirCount != DIRECTORY_COUNT)); then
+		echo "stat_check.sh: $name: $readdirCount types from readdir for $ENTRY_COUNT entries," \
+			 "$opendirCount opendir for $DIRECTORY_COUNT directories." >&2
+		failed=1
+	fi
+
+	printf 'stat_check.sh: %-8s %d entries, %d stat (avoided: %d), %d opendir.\n' \
+		   "$name" "$ENTRY_COUNT" "$statCount" "$avoidedCount" "$opendirCount" >&2
+}
+
+check -r -r -j 1
+check -r-j4 -r -j 4
+check -R -R -j 1
+check -R-j4 -R -j 4
+
+if ((failed)); then
+	echo "stat_check.sh: FAILED." >&2
+	exit 1
+fi
+
+echo "stat_check.sh: OK." >&2
@@ -0,0 +1,43 @@
+// Generated by bake_config from /tmp/t24/cfg/xopen.conf, do not edit.
+// Only included by instruction_index.cpp.
+#ifndef BAKED_CONFIG_H
+#define BAKED_CONFIG_H
+
+static constexpr u32 bakedStringsSize = 67;
+static constexpr char bakedStrings[67 + 1] =
+	"\000zathura\000pdf\000feh\000img\000jpg\000png\000vi\000edit\000txt\000c\000h\000md\000tar\000tar.gz\000mpv\000mkv\000";
+
+static constexpr u32 bakedInstructionCount = 5;
+static constexpr Instruction bakedInstructions[5] =
+{
+	{{1, 7}, {0, 0}, 0, 1},
+	{{13, 3}, {17, 3}, 1, 2},
+	{{29, 2}, {32, 4}, 3, 4},
+	{{48, 3}, {0, 0}, 7, 1},
+	{{59, 3}, {0, 0}, 8, 1},
+};
+
+static constexpr u32 bakedExtensionCount = 9;
+static constexpr StringRef bakedExtensions[9] =
+{
+	{9, 3}, {21, 3}, {25, 3}, {37, 3}, {41, 1}, {43, 1}, {45, 2}, {52, 6},
+	{63, 3},
+};
+
+static constexpr u32 bakedExtensionDisplacements[4] =
+{
+	0, 1, 3, 0,
+};
+
+static constexpr PerfectHashSlot bakedExtensionSlots[16] =
+{
+	{41, 1, 2}, {0, 0, -1}, {0, 0, -1}, {0, 0, -1}, {45, 2, 2}, {25, 3, 1}, {37, 3, 2}, {0, 0, -1},
+	{9, 3, 0}, {43, 1, 2}, {63, 3, 4}, {21, 3, 1}, {0, 0, -1}, {0, 0, -1}, {0, 0, -1}, {52, 6, 3},
+};
+
+static constexpr PerfectHash bakedExtensionHash =
+{
+	14695981039346656037ull, 62, 60, bakedExtensionDisplacements, bakedExtensionSlots
+};
+
+#endif
@@ -0,0 +1,576 @@
+#include "ef_utils.h"
+#include "bash_worker.h"
+#include "command_path.h"
+#include "profile.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pwd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+/*
+  A worker is "bash -c WORKER_SCRIPT" with the request pipe on fd 3,
+  the reply pipe on fd 4 and a memory file on fd 5 (stdin, stdout and
+  stderr are xopen's).
+
+  For each request, the words (the function, then its arguments) are
+  written nul-terminated in the memory file, then their count is sent
+  (nul-terminated) on the request pipe. The reply is the exit code of
+  the function, nul-terminated.
+
+  NOTE: bash reads pipes one byte at a time, but buffers regular
+        files: with 100k arguments, reading them from a pipe is ~50x
+        slower.
+
+  Functions run in a subshell: they cannot change the worker's state
+  (or make it exit), each one starts from the state ~/.bashrc left.
+
+  Workers do not source ~/.bashrc itself but the functions it defines
+  ("declare -f" once, cached in $XDG_CACHE_HOME/xopen/functions until
+  ~/.bashrc changes): it usually does a lot more (prompt, completion,
+  version managers...). Commands which are not one of these functions
+  (e.g. a program in a directory ~/.bashrc adds to $PATH) still get
+  the whole ~/.bashrc, sourced in their subshell.
+*/
+
+#define FUNCTION_CACHE_VERSION 1
+
+// NOTE: Variables are prefixed so ~/.bashrc can not clash with them.
+//       /dev/fd/5 is opened again (not dup'ed) each time, so it's
+//       read from the start.
+//       $1 is the function cache (or ~/.bashrc if there is none).
+static char workerScript[] =
+{
+	". \"$1\"\n"
+	"while IFS= read -r -d '' __xopen_count <&3\n"
+	"do\n"
+	"	mapfile -t -d '' -n \"$__xopen_count\" __xopen_words < /dev/fd/5\n"
+	"	(exec 3<&- 4>&- 5<&-\n"
+	"	 declare -F -- \"${__xopen_words[0]}\" > /dev/null || . ~/.bashrc\n"
+	"	 \"${__xopen_words[@]}\")\n"
+	"	printf '%d\\0' \"$?\" >&4\n"
+	"done\n"
+};
+
+// $1 is the file to write, $2 its first line.
+// NOTE: Only functions are wanted, what ~/.bashrc prints is not.
+static char extractScript[] =
+{
+	". ~/.bashrc > /dev/null\n"
+	"{ printf '%s\\n' \"$2\"; declare -f; } > \"$1\"\n"
+};
+
+extern char **environ;
+
+// Move fd out of the way of 0-5 (dup2'ed in the worker).
+static int moveFileDescriptor(int fd)
+{
+	int movedFd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+
+	close(fd);
+
+	return movedFd;
+}
+
+static b32 statSource(BashPool *pool, struct stat *sourceStat)
+{
+	if (!pool->isSourceKnown)
+	{
+		char *homeDir = getenv("HOME");
+		struct passwd *pw;
+
+		if (!homeDir && ((pw = getpwuid(getuid())) != NULL))
+		{
+			homeDir = pw->pw_dir;
+		}
+
+		snprintf(pool->source, sizeof(pool->source), "%s/.bashrc", homeDir ? homeDir : "");
+		pool->isSourceKnown = true;
+	}
+
+	return (stat(pool->source, sourceStat) == 0);
+}
+
+// Return the exit code of the script, or -1 if it could not run.
+static int runBashScript(char **args)
+{
+	pid_t pid;
+	int error = posix_spawn(&pid, "/bin/bash", NULL, NULL, args, environ);
+
+	if (error)
+	{
+		char buffer[255];
+		snprintf(buffer, sizeof(buffer), "%s: failed to execute bash: %s.\n", ME, strerror(error));
+		fprintf(stderr, buffer);
+
+		return -1;
+	}
+
+	__atomic_add_fetch(&counters.spawnCount, 1, __ATOMIC_RELAXED);
+
+	int status;
+
+	while (waitpid(pid, &status, 0) == -1)
+	{
+		if (errno != EINTR)
+		{
+			return -1;
+		}
+	}
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static b32 isFunctionCacheValid(char *cacheFile, char *header)
+{
+	FILE *file = fopen(cacheFile, "r");
+
+	if (!file)
+	{
+		return false;
+	}
+
+	char line[256];
+	size_t headerLength = strlen(header);
+	b32 isValid = ((fgets(line, sizeof(line), file) != NULL) &&
+				   (strncmp(line, header, headerLength) == 0) &&
+				   (line[headerLength] == '\n'));
+
+	fclose(file);
+
+	return isValid;
+}
+
+// Choose what workers source: the function cache (extracted again if
+// needed), or ~/.bashrc if there can be no cache.
+static void updateWorkerSource(BashPool *pool)
+{
+	char directory[4096];
+	char cacheFile[4096 + 16];
+
+	strcpy(pool->workerSource, pool->source);
+
+	if (!pool->hasSourceStat ||
+		!getCacheDirectory(directory, sizeof(directory), true))
+	{
+		return;
+	}
+
+	snprintf(cacheFile, sizeof(cacheFile), "%s/functions", directory);
+
+	// The first line tells which ~/.bashrc the functions come from.
+	char header[256];
+	snprintf(header, sizeof(header), "# %s-functions %d %llu %llu %lld %lld %lld", ME,
+			 FUNCTION_CACHE_VERSION,
+			 (unsigned long long) pool->sourceStat.st_dev,
+			 (unsigned long long) pool->sourceStat.st_ino,
+			 (long long) pool->sourceStat.st_size,
+			 (long long) pool->sourceStat.st_mtim.tv_sec,
+			 (long long) pool->sourceStat.st_mtim.tv_nsec);
+
+	if (!pool->isRebuildingCache &&
+		isFunctionCacheValid(cacheFile, header))
+	{
+		strcpy(pool->workerSource, cacheFile);
+		return;
+	}
+
+	pool->isRebuildingCache = false;
+
+	char tmpFile[4096 + 32];
+	snprintf(tmpFile, sizeof(tmpFile), "%s.%d", cacheFile, (i32) getpid());
+
+	char *args[] =
+		{
+			"bash",
+			"--norc",
+			"--noprofile",
+			"-c",
+			extractScript,
+			"bash",
+			tmpFile,
+			header,
+			NULL,
+		};
+
+	if ((runBashScript(args) == 0) &&
+		(rename(tmpFile, cacheFile) == 0))
+	{
+		strcpy(pool->workerSource, cacheFile);
+	}
+	else
+	{
+		unlink(tmpFile);
+	}
+}
+
+static b32 startBashWorker(BashPool *pool, BashWorker *worker)
+{
+	int requestPipe[2],
+		replyPipe[2];
+
+	if (pipe2(requestPipe, O_CLOEXEC) == -1)
+	{
+		return false;
+	}
+
+	if (pipe2(replyPipe, O_CLOEXEC) == -1)
+	{
+		close(requestPipe[0]);
+		close(requestPipe[1]);
+
+		return false;
+	}
+
+	int wordsFd = memfd_create(ME "-words", MFD_CLOEXEC);
+
+	requestPipe[0] = moveFileDescriptor(requestPipe[0]);
+	replyPipe[1] = moveFileDescriptor(replyPipe[1]);
+	wordsFd = (wordsFd == -1) ? -1 : moveFileDescriptor(wordsFd);
+
+	posix_spawn_file_actions_t fileActions;
+	posix_spawn_file_actions_init(&fileActions);
+	posix_spawn_file_actions_adddup2(&fileActions, requestPipe[0], 3);
+	posix_spawn_file_actions_adddup2(&fileActions, replyPipe[1], 4);
+	posix_spawn_file_actions_adddup2(&fileActions, wordsFd, 5);
+
+	char *args[] =
+		{
+			"bash",
+			"--norc",
+			"--noprofile",
+			"-c",
+			workerScript,
+			"bash",
+			pool->workerSource,
+			NULL,
+		};
+
+	int error = ((requestPipe[0] == -1) || (replyPipe[1] == -1) || (wordsFd == -1)) ? EMFILE :
+		posix_spawn(&worker->pid, "/bin/bash", &fileActions, NULL, args, environ);
+
+	posix_spawn_file_actions_destroy(&fileActions);
+
+	close(requestPipe[0]);
+	close(replyPipe[1]);
+
+	if (error)
+	{
+		close(requestPipe[1]);
+		close(replyPipe[0]);
+
+		if (wordsFd != -1)
+		{
+			close(wordsFd);
+		}
+
+		char buffer[255];
+		snprintf(buffer, sizeof(buffer), "%s: failed to execute bash: %s.\n", ME, strerror(error));
+		fprintf(stderr, buffer);
+
+		return false;
+	}
+
+	__atomic_add_fetch(&counters.spawnCount, 1, __ATOMIC_RELAXED);
+
+	worker->requestFd = requestPipe[1];
+	worker->replyFd = replyPipe[0];
+	worker->wordsFd = wordsFd;
+	worker->isBusy = false;
+	worker->isStale = false;
+
+	return true;
+}
+
+static void stopBashWorker(BashPool *pool, int workerIndex)
+{
+	BashWorker *worker = pool->workers + workerIndex;
+
+	ASSERT(!worker->isBusy);
+
+	// End of requests: the worker exits.
+	close(worker->requestFd);
+	close(worker->replyFd);
+	close(worker->wordsFd);
+
+	while ((waitpid(worker->pid, NULL, 0) == -1) && (errno == EINTR))
+	{
+	}
+
+	pool->workers[workerIndex] = pool->workers[--pool->workerCount];
+}
+
+// Workers which sourced an older ~/.bashrc are stopped (now if
+// idle, once done otherwise).
+static void checkSource(BashPool *pool)
+{
+	struct stat sourceStat;
+	b32 hasSourceStat = statSource(pool, &sourceStat);
+
+	b32 isSame = (pool->isSourceChecked &&
+				  (hasSourceStat == pool->hasSourceStat));
+
+	if (isSame && hasSourceStat)
+	{
+		isSame = ((sourceStat.st_dev == pool->sourceStat.st_dev) &&
+				  (sourceStat.st_ino == pool->sourceStat.st_ino) &&
+				  (sourceStat.st_size == pool->sourceStat.st_size) &&
+				  (sourceStat.st_mtim.tv_sec == pool->sourceStat.st_mtim.tv_sec) &&
+				  (sourceStat.st_mtim.tv_nsec == pool->sourceStat.st_mtim.tv_nsec));
+	}
+
+	if (isSame)
+	{
+		return;
+	}
+
+	pool->sourceStat = sourceStat;
+	pool->hasSourceStat = hasSourceStat;
+	pool->isSourceChecked = true;
+
+	updateWorkerSource(pool);
+
+	for (int workerIndex = pool->workerCount - 1; workerIndex >= 0; --workerIndex)
+	{
+		if (pool->workers[workerIndex].isBusy)
+		{
+			pool->workers[workerIndex].isStale = true;
+		}
+		else
+		{
+			stopBashWorker(pool, workerIndex);
+		}
+	}
+}
+
+static b32 writeWords(int fd, char *words, size_t size)
+{
+	if (ftruncate(fd, 0) == -1)
+	{
+		return false;
+	}
+
+	off_t offset = 0;
+
+	while (size)
+	{
+		ssize_t written = pwrite(fd, words, size, offset);
+
+		if (written == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		words += written;
+		offset += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+static b32 sendCount(int fd, int count)
+{
+	char request[16];
+	int requestSize = snprintf(request, sizeof(request), "%d", count) + 1;
+
+	// A dead worker must not kill us with SIGPIPE: block it during
+	// the write, and discard it if it was raised.
+	sigset_t pipeSet, previousSet;
+	sigemptyset(&pipeSet);
+	sigaddset(&pipeSet, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipeSet, &previousSet);
+
+	ssize_t written;
+
+	// NOTE: Less than PIPE_BUF, written at once.
+	while (((written = write(fd, request, requestSize)) == -1) && (errno == EINTR))
+	{
+	}
+
+	if ((written == -1) && (errno == EPIPE))
+	{
+		struct timespec noWait = {};
+		sigtimedwait(&pipeSet, NULL, &noWait);
+	}
+
+	pthread_sigmask(SIG_SETMASK, &previousSet, NULL);
+
+	return (written == requestSize);
+}
+
+b32 runInBashWorker(BashPool *pool, char *command, char **arguments, int argumentCount)
+{
+	checkSource(pool);
+
+	BashWorker *worker = NULL;
+
+	for (int workerIndex = 0; workerIndex < pool->workerCount; ++workerIndex)
+	{
+		if (!pool->workers[workerIndex].isBusy)
+		{
+			worker = pool->workers + workerIndex;
+			break;
+		}
+	}
+
+	if (!worker)
+	{
+		if (pool->workerCount == pool->workerCapacity)
+		{
+			pool->workerCapacity = pool->workerCapacity ? 2 * pool->workerCapacity : 4;
+			pool->workers = (BashWorker *) realloc(pool->workers,
+												   pool->workerCapacity * sizeof(BashWorker));
+			ASSERT(pool->workers);
+		}
+
+		worker = pool->workers + pool->workerCount;
+
+		PROFILE_BEGIN(Bash_Start);
+		b32 isStarted = startBashWorker(pool, worker);
+		PROFILE_END(Bash_Start);
+
+		if (!isStarted)
+		{
+			return false;
+		}
+
+		++pool->workerCount;
+	}
+
+	size_t wordsSize = strlen(command) + 1;
+
+	for (int index = 0; index < argumentCount; ++index)
+	{
+		wordsSize += strlen(arguments[index]) + 1;
+	}
+
+	char *words = (char *) malloc(wordsSize);
+	ASSERT(words);
+
+	char *current = stpcpy(words, command) + 1;
+
+	for (int index = 0; index < argumentCount; ++index)
+	{
+		current = stpcpy(current, arguments[index]) + 1;
+	}
+
+	ASSERT((size_t) (current - words) == wordsSize);
+
+	b32 isSent = (writeWords(worker->wordsFd, words, wordsSize) &&
+				  sendCount(worker->requestFd, argumentCount + 1));
+
+	free(words);
+
+	if (!isSent)
+	{
+		char buffer[255];
+		sprintf(buffer, "%s: bash worker exited, could not run %.64s.\n", ME, command);
+		fprintf(stderr, buffer);
+
+		stopBashWorker(pool, worker - pool->workers);
+
+		return false;
+	}
+
+	worker->isBusy = true;
+	++pool->busyCount;
+
+	return true;
+}
+
+b32 waitForBashWorker(BashPool *pool)
+{
+	if (!pool->busyCount)
+	{
+		return false;
+	}
+
+	struct pollfd *pollFds = (struct pollfd *) malloc(pool->workerCount * sizeof(struct pollfd));
+	ASSERT(pollFds);
+
+	for (int workerIndex = 0; workerIndex < pool->workerCount; ++workerIndex)
+	{
+		pollFds[workerIndex].fd = pool->workers[workerIndex].isBusy ? pool->workers[workerIndex].replyFd : -1;
+		pollFds[workerIndex].events = POLLIN;
+		pollFds[workerIndex].revents = 0;
+	}
+
+	int readyCount;
+
+	while (((readyCount = poll(pollFds, pool->workerCount, -1)) == -1) && (errno == EINTR))
+	{
+	}
+
+	// Go backward: stopping a worker moves the last one in its place.
+	for (int workerIndex = pool->workerCount - 1; (readyCount > 0) && (workerIndex >= 0); --workerIndex)
+	{
+		if (!pollFds[workerIndex].revents)
+		{
+			continue;
+		}
+
+		BashWorker *worker = pool->workers + workerIndex;
+
+		// The reply is a few bytes, but read it up to its nul anyway.
+		char reply[16];
+		size_t replySize = 0;
+		ssize_t readSize;
+
+		while ((replySize < sizeof(reply)) &&
+			   (((readSize = read(worker->replyFd, reply + replySize, 1)) == 1) ||
+				((readSize == -1) && (errno == EINTR))))
+		{
+			if ((readSize == 1) && (reply[replySize++] == '\0'))
+			{
+				break;
+			}
+		}
+
+		worker->isBusy = false;
+		--pool->busyCount;
+
+		if (!replySize || (reply[replySize - 1] != '\0'))
+		{
+			char buffer[255];
+			sprintf(buffer, "%s: bash worker exited unexpectedly.\n", ME);
+			fprintf(stderr, buffer);
+
+			stopBashWorker(pool, workerIndex);
+		}
+		else if (worker->isStale)
+		{
+			stopBashWorker(pool, workerIndex);
+		}
+	}
+
+	free(pollFds);
+
+	return true;
+}
+
+void stopBashWorkers(BashPool *pool)
+{
+	while (waitForBashWorker(pool))
+	{
+	}
+
+	while (pool->workerCount)
+	{
+		stopBashWorker(pool, pool->workerCount - 1);
+	}
+
+	free(pool->workers);
+	pool->workers = NULL;
+	pool->workerCapacity = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef BASH_WORKER_H
+#define BASH_WORKER_H
+#include "xopen_common.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// A bash coprocess which sourced ~/.bashrc once, and runs shell
+// functions on demand (see bash_worker.cpp for the protocol).
+struct BashWorker
+{
+	pid_t pid;
+	// Words of a request are written to wordsFd, their count to
+	// requestFd. Exit codes are read from replyFd.
+	int requestFd;
+	int replyFd;
+	int wordsFd;
+
+	b32 isBusy;
+	// ~/.bashrc changed while it was busy: stop it once it's done.
+	b32 isStale;
+};
+
+// NOTE: Workers are started on demand (one per function running at
+//       the same time), and kept until stopBashWorkers.
+struct BashPool
+{
+	BashWorker *workers;
+	int workerCount;
+	int workerCapacity;
+	int busyCount;
+
+	// ~/.bashrc, and its stat when the workers were started.
+	char source[4096];
+	struct stat sourceStat;
+	b32 hasSourceStat;
+	b32 isSourceKnown;
+	b32 isSourceChecked;
+
+	// What workers source: the functions of ~/.bashrc (cached), or
+	// ~/.bashrc itself.
+	char workerSource[4096 + 16];
+	// Extract functions again even if their cache is up to date.
+	b32 isRebuildingCache;
+};
+
+// Run command (a shell function from ~/.bashrc) with arguments in an
+// idle worker, starting one if needed. Arguments are passed as-is
+// (no word splitting or globbing). Does not wait for it to be done.
+// Return false if no worker could run it.
+b32 runInBashWorker(BashPool *pool, char *command, char **arguments, int argumentCount);
+
+// Wait until one of the busy workers is done. Return false if none
+// is busy.
+b32 waitForBashWorker(BashPool *pool);
+
+// Wait for busy workers, then stop all of them.
+void stopBashWorkers(BashPool *pool);
+
+#endif
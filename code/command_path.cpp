@@ -0,0 +1,689 @@
+#include "ef_utils.h"
+#include "xopen_common.h"
+#include "command_path.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pwd.h>
+#include <sys/stat.h>
+
+/*
+  The on-disk cache ($XDG_CACHE_HOME/xopen/commands) is a text file:
+
+  xopen-commands VERSION
+  path $PATH
+  dir MTIME_SEC MTIME_NSEC        (one per $PATH entry, in order)
+  cmd PROBED_COUNT COMMAND [PATH]
+
+  PROBED_COUNT is the number of $PATH entries that were looked into
+  to resolve COMMAND: the entry is only valid as long as none of
+  these directories changed. No PATH means COMMAND was not found (so
+  it's a shell function).
+  The whole file is ignored if $PATH changed.
+*/
+
+#define COMMAND_CACHE_VERSION 1
+
+struct ResolvedCommand
+{
+	char command[255];
+	u32 hash;
+	char path[255];
+	b32 found;
+
+	// Number of $PATH entries the answer depends on (0 if it does
+	// not depend on $PATH, i.e. the command has a slash).
+	int probedCount;
+	b32 fromCache;
+};
+
+struct PathDirectory
+{
+	// Timestamp stored in the cache (if any).
+	i64 cachedMtimeSec;
+	i64 cachedMtimeNsec;
+	b32 isCached;
+
+	// Current timestamp (only computed when needed).
+	i64 mtimeSec;
+	i64 mtimeNsec;
+	b32 isStated;
+	b32 exists;
+};
+
+// NOTE: Grown as needed: the daemon resolves every command of the
+//       config, which may have hundreds. Found through commandSlots
+//       (open addressing, linear probing), which hold an index + 1 (0
+//       if the slot is empty) and are rebuilt when they get half full.
+static ResolvedCommand *resolvedCommands = NULL;
+static int resolvedCommandCount = 0;
+static int resolvedCommandCapacity = 0;
+
+static u32 *commandSlots = NULL;
+static u32 commandSlotCount = 0;
+
+static PathDirectory pathDirectories[128];
+
+static b32 isCacheLoaded = false;
+static b32 isCacheDirty = false;
+
+// $PATH the tables above were filled for.
+static char *loadedPath = NULL;
+
+static u32 hashCommand(char *command)
+{
+	u32 hash = 2166136261u;
+
+	for (char *c = command; *c; ++c)
+	{
+		hash ^= (u8) *c;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void insertCommandSlot(int index)
+{
+	u32 mask = commandSlotCount - 1;
+	u32 slot = resolvedCommands[index].hash & mask;
+
+	while (commandSlots[slot])
+	{
+		slot = (slot + 1) & mask;
+	}
+
+	commandSlots[slot] = index + 1;
+}
+
+// Index resolvedCommands [0, resolvedCommandCount[ again.
+static void rebuildCommandSlots()
+{
+	u32 slotCount = 16;
+
+	while (slotCount < 2 * (u32) resolvedCommandCapacity)
+	{
+		slotCount <<= 1;
+	}
+
+	if (slotCount != commandSlotCount)
+	{
+		free(commandSlots);
+		commandSlots = (u32 *) malloc(slotCount * sizeof(u32));
+		ASSERT(commandSlots);
+		commandSlotCount = slotCount;
+	}
+
+	memset(commandSlots, 0, commandSlotCount * sizeof(u32));
+
+	for (int index = 0; index < resolvedCommandCount; ++index)
+	{
+		insertCommandSlot(index);
+	}
+}
+
+// Next free ResolvedCommand (counted by addResolvedCommand, once
+// filled).
+static ResolvedCommand *reserveResolvedCommand()
+{
+	if (resolvedCommandCount == resolvedCommandCapacity)
+	{
+		resolvedCommandCapacity = resolvedCommandCapacity ? 2 * resolvedCommandCapacity : 64;
+		resolvedCommands = (ResolvedCommand *) realloc(resolvedCommands,
+													   resolvedCommandCapacity * sizeof(ResolvedCommand));
+		ASSERT(resolvedCommands);
+
+		rebuildCommandSlots();
+	}
+
+	return resolvedCommands + resolvedCommandCount;
+}
+
+static void addResolvedCommand()
+{
+	ResolvedCommand *resolved = resolvedCommands + resolvedCommandCount;
+
+	resolved->hash = hashCommand(resolved->command);
+	insertCommandSlot(resolvedCommandCount++);
+}
+
+static ResolvedCommand *findResolvedCommand(char *command)
+{
+	if (!resolvedCommandCount)
+	{
+		return NULL;
+	}
+
+	u32 mask = commandSlotCount - 1;
+	u32 hash = hashCommand(command);
+
+	for (u32 slot = hash & mask; commandSlots[slot]; slot = (slot + 1) & mask)
+	{
+		ResolvedCommand *resolved = resolvedCommands + commandSlots[slot] - 1;
+
+		if ((resolved->hash == hash) &&
+			(strcmp(resolved->command, command) == 0))
+		{
+			return resolved;
+		}
+	}
+
+	return NULL;
+}
+
+static b32 isExecutableFile(char *path)
+{
+	if (faccessat(AT_FDCWD, path, X_OK, AT_EACCESS) != 0)
+	{
+		return false;
+	}
+
+	struct stat pathStat;
+
+	return ((stat(path, &pathStat) == 0) && S_ISREG(pathStat.st_mode));
+}
+
+// Get the directoryIndex-th entry of $PATH. Return its length, or -1
+// if there is no such entry.
+static int getPathDirectory(int directoryIndex, char **directory)
+{
+	char *path = getenv("PATH");
+
+	if (!path)
+	{
+		return -1;
+	}
+
+	char *start = path;
+
+	for (int i = 0; i < directoryIndex; ++i)
+	{
+		start = strchr(start, ':');
+
+		if (!start)
+		{
+			return -1;
+		}
+
+		++start;
+	}
+
+	int length = strchrnul(start, ':') - start;
+
+	// An empty entry means the current directory.
+	if (length == 0)
+	{
+		*directory = (char *) ".";
+		return 1;
+	}
+
+	*directory = start;
+	return length;
+}
+
+static PathDirectory *statPathDirectory(int directoryIndex)
+{
+	if (directoryIndex >= (i32) ARRAY_SIZE(pathDirectories))
+	{
+		return NULL;
+	}
+
+	PathDirectory *pathDirectory = pathDirectories + directoryIndex;
+
+	if (!pathDirectory->isStated)
+	{
+		char *directory;
+		int length = getPathDirectory(directoryIndex, &directory);
+		char buffer[4096];
+		struct stat directoryStat;
+
+		pathDirectory->isStated = true;
+		pathDirectory->exists = false;
+
+		if ((length >= 0) && (length < (i32) ARRAY_SIZE(buffer)))
+		{
+			memcpy(buffer, directory, length);
+			buffer[length] = '\0';
+
+			pathDirectory->exists = (stat(buffer, &directoryStat) == 0);
+		}
+
+		// A missing directory is stored with a -1 timestamp.
+		pathDirectory->mtimeSec = pathDirectory->exists ? directoryStat.st_mtim.tv_sec : -1;
+		pathDirectory->mtimeNsec = pathDirectory->exists ? directoryStat.st_mtim.tv_nsec : -1;
+	}
+
+	return pathDirectory;
+}
+
+static b32 isUpToDate(ResolvedCommand *resolved)
+{
+	for (int directoryIndex = 0; directoryIndex < resolved->probedCount; ++directoryIndex)
+	{
+		PathDirectory *pathDirectory = statPathDirectory(directoryIndex);
+
+		if (!pathDirectory ||
+			!pathDirectory->isCached ||
+			(pathDirectory->cachedMtimeSec != pathDirectory->mtimeSec) ||
+			(pathDirectory->cachedMtimeNsec != pathDirectory->mtimeNsec))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static b32 searchPath(char *command, char *result, size_t resultSize, int *probedCount)
+{
+	*probedCount = 0;
+
+	// Like which, a command containing a slash is not looked up.
+	if (strchr(command, '/'))
+	{
+		if (isExecutableFile(command) &&
+			(strlen(command) < resultSize))
+		{
+			strcpy(result, command);
+			return true;
+		}
+
+		return false;
+	}
+
+	size_t commandLength = strlen(command);
+	char *directory;
+	int directoryLength;
+
+	for (int directoryIndex = 0;
+		 (directoryLength = getPathDirectory(directoryIndex, &directory)) >= 0;
+		 ++directoryIndex)
+	{
+		char candidate[4096];
+
+		// Get the timestamp before looking into the directory, so
+		// a concurrent change invalidates the entry.
+		statPathDirectory(directoryIndex);
+		*probedCount = directoryIndex + 1;
+
+		if (directoryLength + 1 + commandLength < ARRAY_SIZE(candidate))
+		{
+			memcpy(candidate, directory, directoryLength);
+			candidate[directoryLength] = '/';
+			memcpy(candidate + directoryLength + 1, command, commandLength + 1);
+
+			if (isExecutableFile(candidate) &&
+				(strlen(candidate) < resultSize))
+			{
+				strcpy(result, candidate);
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+b32 getCacheDirectory(char *directory, size_t directorySize, b32 create)
+{
+	char *cacheHome = getenv("XDG_CACHE_HOME");
+	int length;
+
+	if (cacheHome && cacheHome[0])
+	{
+		length = snprintf(directory, directorySize, "%s/%s", cacheHome, ME);
+	}
+	else
+	{
+		char *homeDir = getenv("HOME");
+		struct passwd *pw;
+
+		if (!homeDir && ((pw = getpwuid(getuid())) != NULL))
+		{
+			homeDir = pw->pw_dir;
+		}
+
+		if (!homeDir)
+		{
+			return false;
+		}
+
+		length = snprintf(directory, directorySize, "%s/.cache/%s", homeDir, ME);
+	}
+
+	if ((length < 0) || ((size_t) length >= directorySize))
+	{
+		return false;
+	}
+
+	if (create)
+	{
+		// mkdir -p
+		for (char *c = directory + 1; *c; ++c)
+		{
+			if (*c == '/')
+			{
+				*c = '\0';
+				mkdir(directory, 0755);
+				*c = '/';
+			}
+		}
+
+		if ((mkdir(directory, 0755) != 0) && (errno != EEXIST))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static b32 getCommandCacheFile(char *cacheFile, size_t cacheFileSize, b32 create)
+{
+	char directory[4096];
+
+	if (!getCacheDirectory(directory, sizeof(directory), create))
+	{
+		return false;
+	}
+
+	int length = snprintf(cacheFile, cacheFileSize, "%s/commands", directory);
+
+	return ((length > 0) && ((size_t) length < cacheFileSize));
+}
+
+static void loadCommandCache()
+{
+	char cacheFile[4096];
+	char *path = getenv("PATH");
+
+	isCacheLoaded = true;
+
+	free(loadedPath);
+	loadedPath = strdup(path ? path : "");
+	ASSERT(loadedPath);
+
+	if (!path ||
+		!getCommandCacheFile(cacheFile, sizeof(cacheFile), false))
+	{
+		return;
+	}
+
+	FILE *file = fopen(cacheFile, "r");
+
+	if (!file)
+	{
+		return;
+	}
+
+	char *line = NULL;
+	size_t lineSize = 0;
+	ssize_t lineLength;
+	int version = 0;
+	b32 isPathValid = false;
+	int cachedDirectoryCount = 0;
+
+	if ((getline(&line, &lineSize, file) > 0) &&
+		(sscanf(line, "xopen-commands %d", &version) == 1) &&
+		(version == COMMAND_CACHE_VERSION) &&
+		((lineLength = getline(&line, &lineSize, file)) > 0))
+	{
+		if (line[lineLength - 1] == '\n')
+		{
+			line[--lineLength] = '\0';
+		}
+
+		isPathValid = ((strncmp(line, "path ", 5) == 0) &&
+					   (strcmp(line + 5, path) == 0));
+	}
+
+	while (isPathValid &&
+		   ((lineLength = getline(&line, &lineSize, file)) > 0))
+	{
+		if (line[lineLength - 1] == '\n')
+		{
+			line[--lineLength] = '\0';
+		}
+
+		long long mtimeSec, mtimeNsec;
+		int probedCount, commandOffset, commandEnd, pathOffset;
+
+		if (sscanf(line, "dir %lld %lld", &mtimeSec, &mtimeNsec) == 2)
+		{
+			if (cachedDirectoryCount < (i32) ARRAY_SIZE(pathDirectories))
+			{
+				PathDirectory *pathDirectory = pathDirectories + cachedDirectoryCount++;
+
+				pathDirectory->cachedMtimeSec = mtimeSec;
+				pathDirectory->cachedMtimeNsec = mtimeNsec;
+				pathDirectory->isCached = true;
+			}
+		}
+		else if ((commandEnd = 0,
+				  sscanf(line, "cmd %d %n%*s%n", &probedCount, &commandOffset, &commandEnd) == 1) &&
+				 (commandEnd > commandOffset))
+		{
+			ResolvedCommand *resolved = reserveResolvedCommand();
+			int commandLength = commandEnd - commandOffset;
+
+			pathOffset = commandEnd + (line[commandEnd] == ' ');
+
+			if ((commandLength >= (i32) ARRAY_SIZE(resolved->command)) ||
+				(lineLength - pathOffset >= (i32) ARRAY_SIZE(resolved->path)))
+			{
+				continue;
+			}
+
+			memcpy(resolved->command, line + commandOffset, commandLength);
+			resolved->command[commandLength] = '\0';
+			strcpy(resolved->path, line + pathOffset);
+
+			resolved->found = (resolved->path[0] != '\0');
+			resolved->probedCount = probedCount;
+			resolved->fromCache = true;
+
+			if (isUpToDate(resolved) &&
+				!findResolvedCommand(resolved->command))
+			{
+				addResolvedCommand();
+			}
+			else
+			{
+				isCacheDirty = true;
+			}
+		}
+	}
+
+	free(line);
+	fclose(file);
+}
+
+void saveCommandCache()
+{
+	char *path = getenv("PATH");
+	char cacheFile[4096];
+
+	if (!isCacheDirty ||
+		!path ||
+		!getCommandCacheFile(cacheFile, sizeof(cacheFile), true))
+	{
+		return;
+	}
+
+	int directoryCount = 0;
+
+	for (int index = 0; index < resolvedCommandCount; ++index)
+	{
+		if (resolvedCommands[index].probedCount > directoryCount)
+		{
+			directoryCount = resolvedCommands[index].probedCount;
+		}
+	}
+
+	char tmpFile[4096 + 16];
+	snprintf(tmpFile, sizeof(tmpFile), "%s.%d", cacheFile, (i32) getpid());
+
+	FILE *file = fopen(tmpFile, "w");
+
+	if (!file)
+	{
+		return;
+	}
+
+	fprintf(file, "xopen-commands %d\n", COMMAND_CACHE_VERSION);
+	fprintf(file, "path %s\n", path);
+
+	for (int directoryIndex = 0; directoryIndex < directoryCount; ++directoryIndex)
+	{
+		PathDirectory *pathDirectory = statPathDirectory(directoryIndex);
+
+		fprintf(file, "dir %lld %lld\n",
+				(long long) pathDirectory->mtimeSec, (long long) pathDirectory->mtimeNsec);
+	}
+
+	for (int index = 0; index < resolvedCommandCount; ++index)
+	{
+		ResolvedCommand *resolved = resolvedCommands + index;
+
+		fprintf(file, "cmd %d %s%s%s\n", resolved->probedCount, resolved->command,
+				resolved->found ? " " : "", resolved->path);
+	}
+
+	b32 written = (fflush(file) == 0);
+	written &= (fclose(file) == 0);
+
+	if (!written || (rename(tmpFile, cacheFile) != 0))
+	{
+		unlink(tmpFile);
+	}
+	else
+	{
+		isCacheDirty = false;
+	}
+}
+
+// Forget everything if $PATH changed since the tables were filled
+// (only possible in a long-running process, see refreshCommandPaths).
+static void checkLoadedPath()
+{
+	char *path = getenv("PATH");
+
+	if (isCacheLoaded &&
+		(strcmp(loadedPath, path ? path : "") != 0))
+	{
+		resolvedCommandCount = 0;
+		rebuildCommandSlots();
+		memset(pathDirectories, 0, sizeof(pathDirectories));
+
+		isCacheLoaded = false;
+		isCacheDirty = false;
+	}
+}
+
+void refreshCommandPaths()
+{
+	checkLoadedPath();
+
+	if (!isCacheLoaded)
+	{
+		return;
+	}
+
+	// Everything resolved so far is valid for the timestamps we got:
+	// they become the reference, and are fetched again.
+	for (int directoryIndex = 0; directoryIndex < (i32) ARRAY_SIZE(pathDirectories); ++directoryIndex)
+	{
+		PathDirectory *pathDirectory = pathDirectories + directoryIndex;
+
+		if (pathDirectory->isStated)
+		{
+			pathDirectory->cachedMtimeSec = pathDirectory->mtimeSec;
+			pathDirectory->cachedMtimeNsec = pathDirectory->mtimeNsec;
+			pathDirectory->isCached = true;
+			pathDirectory->isStated = false;
+		}
+	}
+
+	int keptCount = 0;
+
+	for (int index = 0; index < resolvedCommandCount; ++index)
+	{
+		if (isUpToDate(resolvedCommands + index))
+		{
+			resolvedCommands[keptCount++] = resolvedCommands[index];
+		}
+		else
+		{
+			isCacheDirty = true;
+		}
+	}
+
+	resolvedCommandCount = keptCount;
+	rebuildCommandSlots();
+}
+
+b32 resolveCommandPath(char *command, char *commandPath, size_t commandPathSize,
+					   b32 *fromCache)
+{
+	if (!isCacheLoaded)
+	{
+		loadCommandCache();
+	}
+
+	ResolvedCommand *resolved = findResolvedCommand(command);
+
+	if (resolved)
+	{
+		if (resolved->found)
+		{
+			strncpy(commandPath, resolved->path, commandPathSize);
+			commandPath[commandPathSize - 1] = '\0';
+		}
+		else
+		{
+			commandPath[0] = '\0';
+		}
+
+		if (fromCache)
+		{
+			*fromCache = resolved->fromCache;
+		}
+
+		return resolved->found;
+	}
+
+	int probedCount;
+	b32 found = searchPath(command, commandPath, commandPathSize, &probedCount);
+
+	if (!found)
+	{
+		commandPath[0] = '\0';
+	}
+
+	if (fromCache)
+	{
+		*fromCache = false;
+	}
+
+	// Commands with a slash do not depend on $PATH, they are not
+	// worth caching.
+	if (!strchr(command, '/') &&
+		(strlen(command) < ARRAY_SIZE(resolved->command)) &&
+		(strlen(commandPath) < ARRAY_SIZE(resolved->path)))
+	{
+		resolved = reserveResolvedCommand();
+
+		strcpy(resolved->command, command);
+		strcpy(resolved->path, commandPath);
+		resolved->found = found;
+		resolved->probedCount = probedCount;
+		resolved->fromCache = false;
+
+		addResolvedCommand();
+
+		isCacheDirty = true;
+	}
+
+	return found;
+}
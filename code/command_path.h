@@ -0,0 +1,25 @@
+#ifndef COMMAND_PATH_H
+#define COMMAND_PATH_H
+
+// Look for command in $PATH (like which(1) does, but without forking).
+// Return true and store its absolute path in commandPath if found,
+// false otherwise (commandPath is then empty).
+// Results are cached for the lifetime of the process, and on disk
+// (see saveCommandCache). fromCache (if any) tells if the answer
+// came from the on-disk cache.
+b32 resolveCommandPath(char *command, char *commandPath, size_t commandPathSize,
+					   b32 *fromCache = NULL);
+
+// Write commands resolved so far to $XDG_CACHE_HOME/xopen/commands
+// (if anything changed).
+void saveCommandCache();
+
+// For long-running processes: check again the $PATH directories
+// resolved commands depend on, and forget the ones that changed.
+void refreshCommandPaths();
+
+// Get $XDG_CACHE_HOME/xopen (or ~/.cache/xopen), creating it if
+// create is true.
+b32 getCacheDirectory(char *directory, size_t directorySize, b32 create);
+
+#endif
@@ -0,0 +1,236 @@
+#include "ef_utils.h"
+#include "config_cache.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+/*
+  Layout of the cache file (all offsets are relative to the start of
+  the file, so it can be used as is once mapped):
+
+  ConfigCacheHeader
+  Instruction[instructionCount]
+  StringRef[extensionCount]
+  char strings[stringsSize]   (each string is nul-terminated)
+
+  That is InstructionTable's arrays, so they are used in place.
+*/
+
+#define CONFIG_CACHE_MAGIC   0x4e45504f58 // "XOPEN"
+#define CONFIG_CACHE_VERSION 1
+
+struct ConfigCacheHeader
+{
+	u64 magic;
+	u32 version;
+	u32 checksum;
+
+	// Used to know if the config file changed since the cache was
+	// written.
+	u64 configDevice;
+	u64 configInode;
+	u64 configSize;
+	i64 configMtimeSec;
+	i64 configMtimeNsec;
+
+	u32 instructionCount;
+	u32 extensionCount;
+	u32 stringsSize;
+	u32 fileSize;
+};
+
+// FNV-1a, only used to detect truncated or garbage caches.
+static u32 computeChecksum(u8 *data, size_t size)
+{
+	u32 hash = 2166136261u;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static b32 configMatches(ConfigCacheHeader *header, struct stat *configStat)
+{
+	return ((header->configDevice == (u64) configStat->st_dev) &&
+			(header->configInode == (u64) configStat->st_ino) &&
+			(header->configSize == (u64) configStat->st_size) &&
+			(header->configMtimeSec == (i64) configStat->st_mtim.tv_sec) &&
+			(header->configMtimeNsec == (i64) configStat->st_mtim.tv_nsec));
+}
+
+static inline b32 isValidString(StringRef *string, char *strings, u32 stringsSize)
+{
+	return ((string->offset < stringsSize) &&
+			(string->length < stringsSize - string->offset) &&
+			(strings[string->offset + string->length] == '\0'));
+}
+
+int loadInstructionsFromCache(char *cacheFile, struct stat *configStat, InstructionTable *table)
+{
+	int fd = open(cacheFile, O_RDONLY | O_CLOEXEC);
+
+	if (fd == -1)
+	{
+		return -1;
+	}
+
+	struct stat cacheStat;
+
+	if ((fstat(fd, &cacheStat) == -1) ||
+		((size_t) cacheStat.st_size < sizeof(ConfigCacheHeader)))
+	{
+		close(fd);
+		return -1;
+	}
+
+	size_t fileSize = cacheStat.st_size;
+	u8 *base = (u8 *) mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (base == MAP_FAILED)
+	{
+		return -1;
+	}
+
+	ConfigCacheHeader *header = (ConfigCacheHeader *) base;
+
+	size_t instructionsOffset = sizeof(ConfigCacheHeader);
+	size_t extensionsOffset = instructionsOffset + (size_t) header->instructionCount * sizeof(Instruction);
+	size_t stringsOffset = extensionsOffset + (size_t) header->extensionCount * sizeof(StringRef);
+
+	if ((header->magic != CONFIG_CACHE_MAGIC) ||
+		(header->version != CONFIG_CACHE_VERSION) ||
+		(header->fileSize != fileSize) ||
+		(stringsOffset + header->stringsSize != fileSize) ||
+		(header->stringsSize == 0) ||
+		!configMatches(header, configStat) ||
+		(header->checksum != computeChecksum(base + instructionsOffset,
+											 fileSize - instructionsOffset)))
+	{
+		munmap(base, fileSize);
+		return -1;
+	}
+
+	Instruction *instructions = (Instruction *) (base + instructionsOffset);
+	StringRef *extensions = (StringRef *) (base + extensionsOffset);
+	char *strings = (char *) (base + stringsOffset);
+
+	for (u32 index = 0; index < header->instructionCount; ++index)
+	{
+		Instruction *instruction = instructions + index;
+
+		if (!isValidString(&instruction->command, strings, header->stringsSize) ||
+			!isValidString(&instruction->tag, strings, header->stringsSize) ||
+			(instruction->extensionFirst > header->extensionCount) ||
+			(instruction->extensionCount > header->extensionCount - instruction->extensionFirst))
+		{
+			munmap(base, fileSize);
+			return -1;
+		}
+	}
+
+	for (u32 index = 0; index < header->extensionCount; ++index)
+	{
+		if (!isValidString(extensions + index, strings, header->stringsSize))
+		{
+			munmap(base, fileSize);
+			return -1;
+		}
+	}
+
+	*table = {};
+
+	table->instructions = instructions;
+	table->instructionCount = header->instructionCount;
+	table->extensions = extensions;
+	table->extensionCount = header->extensionCount;
+	table->strings = strings;
+	table->stringsSize = header->stringsSize;
+
+	table->mapping = base;
+	table->mappingSize = fileSize;
+	table->areArraysMapped = true;
+
+	return header->instructionCount;
+}
+
+int saveInstructionsToCache(char *cacheFile, struct stat *configStat, InstructionTable *parsedTable)
+{
+	// Only the strings used, not the whole config.
+	InstructionTable compactTable;
+	InstructionTable *table = &compactTable;
+
+	copyInstructionTable(table, parsedTable);
+
+	size_t instructionsSize = table->instructionCount * sizeof(Instruction);
+	size_t extensionsSize = table->extensionCount * sizeof(StringRef);
+
+	size_t instructionsOffset = sizeof(ConfigCacheHeader);
+	size_t extensionsOffset = instructionsOffset + instructionsSize;
+	size_t stringsOffset = extensionsOffset + extensionsSize;
+	size_t fileSize = stringsOffset + table->stringsSize;
+
+	u8 *base = (u8 *) calloc(fileSize, 1);
+
+	if (!base)
+	{
+		freeInstructionTable(table);
+		return -1;
+	}
+
+	ConfigCacheHeader *header = (ConfigCacheHeader *) base;
+
+	memcpy(base + instructionsOffset, table->instructions, instructionsSize);
+	memcpy(base + extensionsOffset, table->extensions, extensionsSize);
+	memcpy(base + stringsOffset, table->strings, table->stringsSize);
+
+	header->magic = CONFIG_CACHE_MAGIC;
+	header->version = CONFIG_CACHE_VERSION;
+
+	header->configDevice = configStat->st_dev;
+	header->configInode = configStat->st_ino;
+	header->configSize = configStat->st_size;
+	header->configMtimeSec = configStat->st_mtim.tv_sec;
+	header->configMtimeNsec = configStat->st_mtim.tv_nsec;
+
+	header->instructionCount = table->instructionCount;
+	header->extensionCount = table->extensionCount;
+	header->stringsSize = table->stringsSize;
+	header->fileSize = fileSize;
+
+	header->checksum = computeChecksum(base + instructionsOffset, fileSize - instructionsOffset);
+
+	// Write to a temporary file first, so concurrent runs never see
+	// a half-written cache.
+	char tmpFile[512];
+	snprintf(tmpFile, sizeof(tmpFile), "%s.%d", cacheFile, (i32) getpid());
+
+	int result = -1;
+	int fd = open(tmpFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd != -1)
+	{
+		b32 written = (write(fd, base, fileSize) == (ssize_t) fileSize);
+		close(fd);
+
+		if (written && (rename(tmpFile, cacheFile) == 0))
+		{
+			result = 0;
+		}
+		else
+		{
+			unlink(tmpFile);
+		}
+	}
+
+	free(base);
+	freeInstructionTable(table);
+
+	return result;
+}
@@ -0,0 +1,16 @@
+#ifndef CONFIG_CACHE_H
+#define CONFIG_CACHE_H
+#include "xopen_common.h"
+#include "instruction_table.h"
+
+#include <sys/stat.h>
+
+// Return the number of instructions, or -1 if the cache is missing,
+// stale (configStat does not match) or corrupt. On success table
+// points inside of the mapped cache (see freeInstructionTable).
+int loadInstructionsFromCache(char *cacheFile, struct stat *configStat, InstructionTable *table);
+
+// Return 0 on success, -1 otherwise.
+int saveInstructionsToCache(char *cacheFile, struct stat *configStat, InstructionTable *table);
+
+#endif
@@ -2,6 +2,23 @@
 #include "config_file_parser.h"
 
 #include <string.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define HAS_VECTOR_CLASSIFY 1
+#else
+#define HAS_VECTOR_CLASSIFY 0
+#endif
+
+// The config is classified by blocks of 64 bytes: it's padded with
+// zeroes up to the next block.
+#define CLASSIFY_BLOCK_SIZE 64
+
+// A generated config can have many errors, only the first ones are
+// shown.
+#define MAX_REPORTED_ERRORS 20
 
 enum TokenType
 {
@@ -29,10 +46,24 @@ struct Token
 	TokenType type;
 };
 
+// Bit i of word i / 64 is set if byte i of the config is:
+struct CharacterMasks
+{
+	u64 *whitespace;
+	u64 *literal;
+	// '\n', '\r' or '\0'.
+	u64 *endOfLine;
+	// Whitespace or end of line.
+	u64 *endOfWord;
+};
+
 struct Tokenizer
 {
+	char *start;
     char *at;
 	int line;
+
+	CharacterMasks masks;
 };
 
 enum InstructionTokenType
@@ -43,26 +74,27 @@ enum InstructionTokenType
 	Instruction_Argument,
 };
 
-static char *readEntireFile(char *filename)
+// NOTE: The config is mapped read-only (MAP_PRIVATE) over zeroed pages,
+//       so it's followed by '\0' and padded to classify it by whole
+//       blocks (the rest of the last page of a file reads as zeroes).
+//       Nothing is read or copied until used, return NULL on error.
+static char *mapEntireFile(int fd, size_t size, size_t *mappingSize)
 {
-	char *result = NULL;
-	
-	FILE *file = fopen(filename, "r");
+	*mappingSize = size + 1 + CLASSIFY_BLOCK_SIZE;
 
-	if (file)
-	{
-		fseek(file, 0, SEEK_END);
-		
-		size_t fileSize = ftell(file);
-		fseek(file, 0, SEEK_SET);
+	char *result = (char *) mmap(NULL, *mappingSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
+	if (result == MAP_FAILED)
+	{
+		return NULL;
+	}
 
-		result = (char *) malloc(fileSize + 1);
-		
-		fread(result, fileSize, 1, file);
-		result[fileSize] = '\0';
-		
-		fclose(file);
+	// An empty file can't be mapped.
+	if (size &&
+		(mmap(result, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED))
+	{
+		munmap(result, *mappingSize);
+		return NULL;
 	}
 
 	return result;
@@ -92,19 +124,210 @@ static inline b32 isEndOfLine(char c)
 			(c == '\r'));
 }
 
+// NOTE: '.' and '*' are for extensions like tar.gz, *rc or Makefile*
+//       (see extension_trie.h).
 static inline b32 isValidLiteralChar(char c)
 {
 	return (isAlpha(c) ||
 			isNumeric(c) ||
-			(c == '/'));
+			(c == '/') ||
+			(c == '.') ||
+			(c == '*'));
 }
 
-static inline void skipWhitespace(Tokenizer *tokenizer)
+/*
+  Before tokenizing, the whole config is classified once, 64 bytes at a
+  time: with SSE2 (always there on x86-64) or AVX2 (if the CPU has it),
+  each byte is compared to the delimiters, and the results are packed
+  into bit masks with movemask. The tokenizer then finds the end of a
+  run (whitespace, literal, comment, tag) by counting trailing zeroes in
+  these masks, instead of testing each byte.
+*/
+
+enum CharacterClass
 {
-	while (isWhitespace(tokenizer->at[0]))
+	CharacterClass_Whitespace	= 1 << 0,
+	CharacterClass_Literal		= 1 << 1,
+	CharacterClass_EndOfLine	= 1 << 2,
+};
+
+// Without SIMD, bytes are classified with a table (built once).
+static void classifyBlockScalar(char *block, u64 *whitespace, u64 *literal, u64 *endOfLine)
+{
+	static u8 characterClasses[256];
+	static b32 isTableBuilt = false;
+
+	if (!isTableBuilt)
 	{
-		++(tokenizer->at);
+		for (int c = 0; c < 256; ++c)
+		{
+			characterClasses[c] = ((isWhitespace((char) c) ? CharacterClass_Whitespace : 0) |
+								   (isValidLiteralChar((char) c) ? CharacterClass_Literal : 0) |
+								   ((isEndOfLine((char) c) || !c) ? CharacterClass_EndOfLine : 0));
+		}
+
+		isTableBuilt = true;
 	}
+
+	u64 whitespaceBits = 0,
+		literalBits = 0,
+		endOfLineBits = 0;
+
+	for (int i = 0; i < CLASSIFY_BLOCK_SIZE; ++i)
+	{
+		u64 characterClass = characterClasses[(u8) block[i]];
+
+		whitespaceBits |= (characterClass & 1) << i;
+		literalBits |= ((characterClass >> 1) & 1) << i;
+		endOfLineBits |= ((characterClass >> 2) & 1) << i;
+	}
+
+	*whitespace = whitespaceBits;
+	*literal = literalBits;
+	*endOfLine = endOfLineBits;
+}
+
+#if HAS_VECTOR_CLASSIFY
+
+// NOTE: Compares are signed: bytes >= 0x80 are below every range.
+static inline __m128i isInRange16(__m128i bytes, char first, char last)
+{
+	return _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(first - 1)),
+						 _mm_cmpgt_epi8(_mm_set1_epi8(last + 1), bytes));
+}
+
+static void classifyBlock16(char *block, u64 *whitespace, u64 *literal, u64 *endOfLine)
+{
+	*whitespace = 0;
+	*literal = 0;
+	*endOfLine = 0;
+
+	for (int i = 0; i < CLASSIFY_BLOCK_SIZE; i += 16)
+	{
+		__m128i bytes = _mm_loadu_si128((__m128i *) (block + i));
+
+		__m128i isSpace = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+													_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t'))),
+									   _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r')));
+		// Letters are lower-cased by setting 0x20.
+		// '.' and '/' follow each other.
+		__m128i isLiteral = _mm_or_si128(_mm_or_si128(isInRange16(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), 'a', 'z'),
+													  isInRange16(bytes, '.', '9')),
+										 _mm_cmpeq_epi8(bytes, _mm_set1_epi8('*')));
+		__m128i isLineEnd = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')),
+													  _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r'))),
+										 _mm_cmpeq_epi8(bytes, _mm_setzero_si128()));
+
+		*whitespace |= (u64) (u16) _mm_movemask_epi8(isSpace) << i;
+		*literal |= (u64) (u16) _mm_movemask_epi8(isLiteral) << i;
+		*endOfLine |= (u64) (u16) _mm_movemask_epi8(isLineEnd) << i;
+	}
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i isInRange32(__m256i bytes, char first, char last)
+{
+	return _mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(first - 1)),
+							_mm256_cmpgt_epi8(_mm256_set1_epi8(last + 1), bytes));
+}
+
+static AVX2 void classifyBlock32(char *block, u64 *whitespace, u64 *literal, u64 *endOfLine)
+{
+	*whitespace = 0;
+	*literal = 0;
+	*endOfLine = 0;
+
+	for (int i = 0; i < CLASSIFY_BLOCK_SIZE; i += 32)
+	{
+		__m256i bytes = _mm256_loadu_si256((__m256i *) (block + i));
+
+		__m256i isSpace = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+														  _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\t'))),
+										  _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\r')));
+		__m256i isLiteral = _mm256_or_si256(_mm256_or_si256(isInRange32(_mm256_or_si256(bytes, _mm256_set1_epi8(0x20)), 'a', 'z'),
+															isInRange32(bytes, '.', '9')),
+											_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('*')));
+		__m256i isLineEnd = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')),
+															_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\r'))),
+											_mm256_cmpeq_epi8(bytes, _mm256_setzero_si256()));
+
+		*whitespace |= (u64) (u32) _mm256_movemask_epi8(isSpace) << i;
+		*literal |= (u64) (u32) _mm256_movemask_epi8(isLiteral) << i;
+		*endOfLine |= (u64) (u32) _mm256_movemask_epi8(isLineEnd) << i;
+	}
+}
+
+#endif
+
+typedef void ClassifyBlockProc(char *block, u64 *whitespace, u64 *literal, u64 *endOfLine);
+
+static ClassifyBlockProc *getClassifyBlockProc()
+{
+#if HAS_VECTOR_CLASSIFY
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return classifyBlock32;
+	}
+
+	return classifyBlock16;
+#else
+	return classifyBlockScalar;
+#endif
+}
+
+// text must be padded with zeroes up to the next CLASSIFY_BLOCK_SIZE
+// (past its '\0').
+static void classifyCharacters(CharacterMasks *masks, char *text, size_t size,
+							   ClassifyBlockProc *classifyBlock = getClassifyBlockProc())
+{
+	// + 1: the '\0' ends every run.
+	size_t wordCount = (size + 1 + CLASSIFY_BLOCK_SIZE - 1) / CLASSIFY_BLOCK_SIZE;
+	u64 *words = (u64 *) malloc(4 * wordCount * sizeof(u64));
+	ASSERT(words);
+
+	masks->whitespace = words;
+	masks->literal = words + wordCount;
+	masks->endOfLine = words + 2 * wordCount;
+	masks->endOfWord = words + 3 * wordCount;
+
+	for (size_t i = 0; i < wordCount; ++i)
+	{
+		classifyBlock(text + i * CLASSIFY_BLOCK_SIZE,
+					  masks->whitespace + i, masks->literal + i, masks->endOfLine + i);
+		masks->endOfWord[i] = masks->whitespace[i] | masks->endOfLine[i];
+	}
+}
+
+static void freeCharacterMasks(CharacterMasks *masks)
+{
+	free(masks->whitespace);
+	*masks = {};
+}
+
+// First byte from at whose bit in mask is value. There always is one
+// before the end of the masks ('\0' is set in endOfLine, and not in
+// the others).
+static inline char *findMaskBit(Tokenizer *tokenizer, u64 *mask, char *at, b32 value)
+{
+	size_t position = at - tokenizer->start;
+	size_t word = position / 64;
+	u64 flip = value ? 0 : ~0ull;
+	u64 bits = (mask[word] ^ flip) >> (position % 64);
+
+	if (bits)
+	{
+		return at + __builtin_ctzll(bits);
+	}
+
+	while (!(bits = mask[++word] ^ flip));
+
+	return tokenizer->start + word * 64 + __builtin_ctzll(bits);
+}
+
+static inline void skipWhitespace(Tokenizer *tokenizer)
+{
+	tokenizer->at = findMaskBit(tokenizer, tokenizer->masks.whitespace, tokenizer->at, false);
 }
 
 static Token getNextToken(Tokenizer *tokenizer)
@@ -133,15 +356,13 @@ static Token getNextToken(Tokenizer *tokenizer)
 
 				token.type = Token_LineComment;
 				token.text = tokenizer->at;
-					
-				while(tokenizer->at[0] &&
-					  !isEndOfLine(tokenizer->at[0]))
-				{
-					++(tokenizer->at);
-				}
+				tokenizer->at = findMaskBit(tokenizer, tokenizer->masks.endOfLine, tokenizer->at, true);
 
+				// NOTE: The end of line is left for the next token, so
+				//       a comment can end a line with an instruction.
 				token.length = tokenizer->at - token.text;
-				++(tokenizer->line);
+				--(tokenizer->at);
+				
 				break;
 			}
 			case '@':
@@ -150,13 +371,7 @@ static Token getNextToken(Tokenizer *tokenizer)
 
 				token.type = Token_Tag;
 				token.text = tokenizer->at;
-					
-				while(tokenizer->at[0] &&
-					  !(isWhitespace(tokenizer->at[0]) ||
-						isEndOfLine(tokenizer->at[0])))
-				{
-					++(tokenizer->at);
-				}
+				tokenizer->at = findMaskBit(tokenizer, tokenizer->masks.endOfWord, tokenizer->at, true);
 
 				token.length = tokenizer->at - token.text;
 				--(tokenizer->at);
@@ -171,8 +386,7 @@ static Token getNextToken(Tokenizer *tokenizer)
 				if (isValidLiteralChar(tokenizer->at[0]))
 				{
 					token.type = Token_Literal;
-
-					while (isValidLiteralChar((++tokenizer->at)[0]));
+					tokenizer->at = findMaskBit(tokenizer, tokenizer->masks.literal, tokenizer->at + 1, false);
 
 					token.length = tokenizer->at - token.text;
 					--(tokenizer->at);
@@ -212,19 +426,6 @@ static b32 tokenEquals(Token *token, char *text)
 	return true;
 }
 
-static Token getToken(Tokenizer *tokenizer, TokenType type)
-{
-	Token token = {};
-
-	do
-	{
-		token = getNextToken(tokenizer);
-
-	} while ((token.type != Token_EOF) && (token.type != type));
-
-	return token;
-}
-
 static Token getToken(Tokenizer *tokenizer, char *text)
 {
 	Token token = {};
@@ -240,52 +441,77 @@ static Token getToken(Tokenizer *tokenizer, char *text)
 	return token;
 }
 
-static b32 isValidInstruction(Instruction *instruction, Instruction *allInstructions, int allInstructionsSize)
+// Next token is the end of the line.
+static inline void skipLine(Tokenizer *tokenizer)
 {
-	int instructionIndex = (instruction - allInstructions);
-	
-	return ((instructionIndex >= 0) &&
-			(instructionIndex < allInstructionsSize) &&
-			(instruction->commandLength > 0));
+	tokenizer->at = findMaskBit(tokenizer, tokenizer->masks.endOfLine, tokenizer->at, true);
+}
+
+static void reportError(char *configFile, Tokenizer *tokenizer, int *errorCount, char *format, ...)
+{
+	if (++(*errorCount) > MAX_REPORTED_ERRORS)
+	{
+		return;
+	}
+
+	fprintf(stderr, "%s: %s, line %d: ", ME, configFile, tokenizer->line);
+
+	va_list arguments;
+	va_start(arguments, format);
+	vfprintf(stderr, format, arguments);
+	va_end(arguments);
+
+	fprintf(stderr, ".\n");
 }
 
 /*
-  IMPORTANT
-   
-  Memory allocated to parse the config file must not be freed until
-  instructions are no longer used.
-  This allow not having to copy/paste the strings around.
-   
+  NOTE
+
+  A single pass over the config: the strings of the instructions are
+  views into its mapping (kept as the pool of the table), nothing is
+  copied. A line with an error is skipped (and reported), the rest of
+  the config is still used.
 */
-// Return the number of instructions (it it's 0 or if there is an
-// error, the memory is freed).
-int makeInstructionsFromConfig(char *configFile, Instruction *allInstructions,
-							   int allInstructionsSize)
+int makeInstructionsFromConfig(char *configFile, int configFd, size_t configSize, InstructionTable *table)
 {
-	char *content = readEntireFile(configFile);
+	size_t mappingSize;
+	char *content = mapEntireFile(configFd, configSize, &mappingSize);
+
+	if (!content)
+	{
+		fprintf(stderr, "%s: %s: could not read config file.\n", ME, configFile);
+		initInstructionTable(table);
+
+		return 0;
+	}
 
-	ASSERT(content);
+	counters.configByteCount += configSize;
 
+	// NOTE: A '\0' in the config ends it (it's the end of the last line).
 	Tokenizer tokenizer = {};
+	tokenizer.start = content;
 	tokenizer.at = content;
+	tokenizer.line = 1;
+	classifyCharacters(&tokenizer.masks, tokenizer.start, configSize);
+
+	initInstructionTableFromMapping(table, content, (u32) (configSize + 1), mappingSize);
+	reserveInstructionTable(table, configSize);
 
-	b32 parsing = true,
-		skipLine = false;
+	int errorCount = 0;
 	
-	// Shorter to write if we start before. 
-	Instruction *instruction = allInstructions;
+	// The last instruction of table, until the end of its line.
+	Instruction *instruction = NULL;
 	
 	Token token;
 	InstructionTokenType instructionTokenType = Instruction_Command;
 		
 	do
 	{
-		token = (skipLine) ? getToken(&tokenizer, Token_Newline) : getNextToken(&tokenizer);
-		skipLine = false;
+		token = getNextToken(&tokenizer);
 
 		switch (token.type)
 		{
-			case Token_EOF: {parsing = false; break;}
+			case Token_EOF: {break;}
 
 				//case Token_Percent: {instructionTokenType = Instruction_Parameter ;		break;}
 				// TODO: When we allow parameters, check to see if
@@ -297,15 +523,10 @@ int makeInstructionsFromConfig(char *configFile, Instruction *allInstructions,
 				//       file. (This stands for other InstructionTypes as well)
 			case Token_Minus:
 			{
-				if (!isValidInstruction(instruction, allInstructions, allInstructionsSize))
+				if (!instruction)
 				{
-					char buffer[255];
-
-					sprintf(buffer, "%s: %s, line %d: skipping line, no command given.\n",
-							ME, configFile, tokenizer.line);
-					fprintf(stderr, buffer);
-
-					skipLine = true;
+					reportError(configFile, &tokenizer, &errorCount, "skipping line, no command given");
+					skipLine(&tokenizer);
 
 					break;
 				}
@@ -317,12 +538,7 @@ int makeInstructionsFromConfig(char *configFile, Instruction *allInstructions,
 			{
 				instructionTokenType = Instruction_Command;
 
-				if (isValidInstruction(instruction, allInstructions, allInstructionsSize))
-				{
-					++instruction;
-					instruction->commandLength = 0;
-					instruction->tagLength = 0;
-				}
+				instruction = NULL;
 				
 				break;
 			}
@@ -333,44 +549,31 @@ int makeInstructionsFromConfig(char *configFile, Instruction *allInstructions,
 				//	case Token_CloseParenthesis: {instructionTokenType = Instruction_Command;	break;}
 			case Token_Tag:
 			{
-				if (!isValidInstruction(instruction, allInstructions, allInstructionsSize))
+				if (!instruction)
 				{
-					char buffer[255];
-
-					sprintf(buffer, "%s: %s, line %d: skipping line, no command given for tag %.*s.\n",
-							ME, configFile, tokenizer.line, (i32) token.length, token.text);
-					fprintf(stderr, buffer);
-
-					skipLine = true;
+					reportError(configFile, &tokenizer, &errorCount, "skipping line, no command given for tag %.*s",
+								(i32) token.length, token.text);
+					skipLine(&tokenizer);
 
 					break;
 				}
 
 				if (token.length == 0)
 				{
-					char buffer[255];
-
-					sprintf(buffer, "%s: %s, line %d: ignoring, tag is empty for command %.*s.\n",
-							ME, configFile, tokenizer.line, instruction->commandLength, instruction->command);
-					fprintf(stderr, buffer);
-
+					reportError(configFile, &tokenizer, &errorCount, "ignoring, tag is empty for command %.*s",
+								(i32) instruction->command.length, getString(table, instruction->command));
 					break;
 				}
 
-				if (instruction->tagLength)
+				if (instruction->tag.length)
 				{
-					char buffer[255];
-
-					sprintf(buffer, "%s: %s, line %d: ignoring, additional tag %.*s for command %.*s.\n",
-							ME, configFile, tokenizer.line, (i32) token.length, token.text,
-							instruction->commandLength, instruction->command);
-					fprintf(stderr, buffer);
-
+					reportError(configFile, &tokenizer, &errorCount, "ignoring, additional tag %.*s for command %.*s",
+								(i32) token.length, token.text,
+								(i32) instruction->command.length, getString(table, instruction->command));
 					break;
 				}
 
-				instruction->tag = token.text;
-				instruction->tagLength = token.length;
+				instruction->tag = getStringView(table, token.text, token.length);
 				
 				break;
 			}
@@ -380,29 +583,9 @@ int makeInstructionsFromConfig(char *configFile, Instruction *allInstructions,
 				{
 					case Instruction_Command:
 					{
-						if ((instruction - allInstructions) >= allInstructionsSize)
-						{
-							parsing = false;
-							
-							char buffer[255];
-							
-							sprintf(buffer, "%s: %s, line %d: skipping the rest, number of instructions exceeds %d.\n",
-									ME, configFile, tokenizer.line, allInstructionsSize);
-							fprintf(stderr, buffer);
-							
-							break;
-						}
-						
-						// TODO: See main.cpp. (Move which here).
-						//       Separate command from it's path (in
+						// TODO: Separate command from it's path (in
 						//       parenthesis) when given.
-						instruction->commandPath[0] = '\0';
-						
-						strncpy(instruction->command, token.text, token.length);
-						instruction->commandLength = token.length;
-
-						instruction->argumentCount = 0;
-						instruction->extensionCount = 0;
+						instruction = addInstruction(table, getStringView(table, token.text, token.length));
 
 						instructionTokenType = Instruction_Parameter;
 						
@@ -410,46 +593,47 @@ int makeInstructionsFromConfig(char *configFile, Instruction *allInstructions,
 					}
 					case Instruction_Argument:
 					{
-						int extensionIndex = instruction->extensionCount++;
-						
-						strncpy(instruction->extensions[extensionIndex],
-								token.text, token.length);
-						instruction->extensionsLength[extensionIndex] = token.length;
+						addExtension(table, getStringView(table, token.text, token.length));
 						
 						break;
 					}
 					default:
 					{
-						parsing = false;
-							
-						instruction = allInstructions - 1;
+						reportError(configFile, &tokenizer, &errorCount,
+									"skipping line, %.*s given after command %.*s (missing '-'?)",
+									(i32) token.length, token.text,
+									(i32) instruction->command.length, getString(table, instruction->command));
+
+						removeLastInstruction(table);
+						instruction = NULL;
+						skipLine(&tokenizer);
+
 						break;
 					}
 				}
 				
 				break;
 			}
+			case Token_Unknown:
+			{
+				reportError(configFile, &tokenizer, &errorCount, "ignoring unexpected character '%c'",
+							token.text[0]);
+				break;
+			}
 
 			default:
 			{
 				break;
 			}
 		}
-	} while (token.type != Token_EOF && parsing);
+	} while (token.type != Token_EOF);
 
-	if ((instruction - allInstructions) < 0)
+	if (errorCount > MAX_REPORTED_ERRORS)
 	{
-		free(content);
-		
-		return 0;
+		fprintf(stderr, "%s: %s: %d more errors.\n", ME, configFile, errorCount - MAX_REPORTED_ERRORS);
 	}
-	
-	int instructionCount = (instruction - allInstructions) + (instruction->commandLength != 0);
 
-	if (!instructionCount)
-	{
-		free(content);
-	}
+	freeCharacterMasks(&tokenizer.masks);
 
-	return instructionCount;
+	return table->instructionCount;
 }
@@ -1,7 +1,11 @@
 #ifndef CONFIG_FILE_PARSER_H
 #define CONFIG_FILE_PARSER_H
 #include "xopen_common.h"
+#include "instruction_table.h"
 
-int makeInstructionsFromConfig(char *configFile, Instruction *allInstructions, int allInstructionsSize);
+// Return the number of instructions; table is (re)initialised, free it
+// with freeInstructionTable. configFd (of configSize bytes) is mapped,
+// it can be closed once this returns.
+int makeInstructionsFromConfig(char *configFile, int configFd, size_t configSize, InstructionTable *table);
 
 #endif
@@ -0,0 +1,477 @@
+#include "ef_utils.h"
+#include "daemon.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+  A request is:
+
+  - A DaemonRequestHeader, sent along with the client's stdin, stdout
+    and stderr (SCM_RIGHTS).
+  - payloadSize bytes: the working directory, then argumentCount
+    arguments, then environmentCount environment variables, all
+    nul-terminated.
+
+  The daemon forks a child per request, which replaces its own
+  working directory, environment and standard streams with the
+  client's ones before handling it. The child answers with the exit
+  code (an i32) once done; the client waits for it, so the exit code
+  and the output order are the same as if it had run in-process.
+*/
+
+#define DAEMON_MAGIC 0x44504f58
+#define DAEMON_VERSION 1
+
+// NOTE: Arguments and environment are bounded by ARG_MAX in the
+//       client, anything bigger is garbage.
+#define MAX_PAYLOAD_SIZE (64 * 1024 * 1024)
+
+struct DaemonRequestHeader
+{
+	u32 magic;
+	u32 version;
+
+	u32 argumentCount;
+	u32 environmentCount;
+	u32 payloadSize;
+};
+
+extern char **environ;
+
+b32 getDaemonSocketPath(char *path, size_t pathSize)
+{
+	char *runtimeDirectory = getenv("XDG_RUNTIME_DIR");
+
+	if (!runtimeDirectory || !runtimeDirectory[0])
+	{
+		return false;
+	}
+
+	int length = snprintf(path, pathSize, "%s/%s.sock", runtimeDirectory, ME);
+
+	return ((length > 0) && ((size_t) length < pathSize));
+}
+
+static b32 writeAll(int fd, void *data, size_t size)
+{
+	char *at = (char *) data;
+
+	while (size)
+	{
+		ssize_t written = send(fd, at, size, MSG_NOSIGNAL);
+
+		if (written <= 0)
+		{
+			if ((written == -1) && (errno == EINTR))
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		at += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+static b32 readAll(int fd, void *data, size_t size)
+{
+	char *at = (char *) data;
+
+	while (size)
+	{
+		ssize_t readSize = read(fd, at, size);
+
+		if (readSize <= 0)
+		{
+			if ((readSize == -1) && (errno == EINTR))
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		at += readSize;
+		size -= readSize;
+	}
+
+	return true;
+}
+
+static int connectToDaemon(struct sockaddr_un *address)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (fd == -1)
+	{
+		return -1;
+	}
+
+	if (connect(fd, (struct sockaddr *) address, sizeof(*address)) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+b32 forwardToDaemon(int argc, char **argv, int *exitCode)
+{
+	struct sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+
+	if (!getDaemonSocketPath(address.sun_path, sizeof(address.sun_path)))
+	{
+		return false;
+	}
+
+	char workingDirectory[4096];
+
+	if (!getcwd(workingDirectory, sizeof(workingDirectory)))
+	{
+		return false;
+	}
+
+	int fd = connectToDaemon(&address);
+
+	if (fd == -1)
+	{
+		return false;
+	}
+
+	DaemonRequestHeader header = {};
+	header.magic = DAEMON_MAGIC;
+	header.version = DAEMON_VERSION;
+	header.argumentCount = argc;
+
+	size_t payloadSize = strlen(workingDirectory) + 1;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		payloadSize += strlen(argv[i]) + 1;
+	}
+
+	for (char **variable = environ; *variable; ++variable)
+	{
+		payloadSize += strlen(*variable) + 1;
+		++header.environmentCount;
+	}
+
+	header.payloadSize = payloadSize;
+
+	char *payload = (char *) malloc(payloadSize);
+	ASSERT(payload);
+
+	char *at = stpcpy(payload, workingDirectory) + 1;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		at = stpcpy(at, argv[i]) + 1;
+	}
+
+	for (char **variable = environ; *variable; ++variable)
+	{
+		at = stpcpy(at, *variable) + 1;
+	}
+
+	// The header carries our standard streams.
+	int streams[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+
+	union
+	{
+		char buffer[CMSG_SPACE(sizeof(streams))];
+		struct cmsghdr alignment;
+	} control = {};
+
+	struct iovec headerVector = {&header, sizeof(header)};
+	struct msghdr message = {};
+	message.msg_iov = &headerVector;
+	message.msg_iovlen = 1;
+	message.msg_control = control.buffer;
+	message.msg_controllen = sizeof(control.buffer);
+
+	struct cmsghdr *controlMessage = CMSG_FIRSTHDR(&message);
+	controlMessage->cmsg_level = SOL_SOCKET;
+	controlMessage->cmsg_type = SCM_RIGHTS;
+	controlMessage->cmsg_len = CMSG_LEN(sizeof(streams));
+	memcpy(CMSG_DATA(controlMessage), streams, sizeof(streams));
+
+	// NOTE: If anything fails before the whole request is sent, the
+	//       daemon drops it: handling it in-process is safe.
+	b32 isSent = ((sendmsg(fd, &message, MSG_NOSIGNAL) == (ssize_t) sizeof(header)) &&
+				  writeAll(fd, payload, payloadSize));
+
+	free(payload);
+
+	if (!isSent)
+	{
+		close(fd);
+		return false;
+	}
+
+	i32 code;
+
+	if (!readAll(fd, &code, sizeof(code)))
+	{
+		char buffer[255];
+		sprintf(buffer, "%s: lost connection to the daemon.\n", ME);
+		fprintf(stderr, buffer);
+
+		code = 1;
+	}
+
+	close(fd);
+
+	*exitCode = code;
+	return true;
+}
+
+// Return the exit code of the child serving the request.
+static int serveRequest(int connection, DaemonRequestProc *handleRequest, void *data)
+{
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGPIPE, SIG_DFL);
+
+	DaemonRequestHeader header;
+	int streams[3];
+
+	union
+	{
+		char buffer[CMSG_SPACE(sizeof(streams))];
+		struct cmsghdr alignment;
+	} control = {};
+
+	struct iovec headerVector = {&header, sizeof(header)};
+	struct msghdr message = {};
+	message.msg_iov = &headerVector;
+	message.msg_iovlen = 1;
+	message.msg_control = control.buffer;
+	message.msg_controllen = sizeof(control.buffer);
+
+	ssize_t readSize;
+
+	do
+	{
+		readSize = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+	} while ((readSize == -1) && (errno == EINTR));
+
+	struct cmsghdr *controlMessage = CMSG_FIRSTHDR(&message);
+
+	if ((readSize != (ssize_t) sizeof(header)) ||
+		!controlMessage ||
+		(controlMessage->cmsg_level != SOL_SOCKET) ||
+		(controlMessage->cmsg_type != SCM_RIGHTS) ||
+		(controlMessage->cmsg_len != CMSG_LEN(sizeof(streams))))
+	{
+		return 1;
+	}
+
+	memcpy(streams, CMSG_DATA(controlMessage), sizeof(streams));
+
+	if ((header.magic != DAEMON_MAGIC) ||
+		(header.version != DAEMON_VERSION) ||
+		(header.argumentCount == 0) ||
+		(header.payloadSize > MAX_PAYLOAD_SIZE) ||
+		(header.argumentCount + header.environmentCount >= header.payloadSize))
+	{
+		return 1;
+	}
+
+	char *payload = (char *) malloc(header.payloadSize);
+	char **strings = (char **) malloc((header.argumentCount + header.environmentCount + 2) *
+									  sizeof(char *));
+	ASSERT(payload && strings);
+
+	if (!readAll(connection, payload, header.payloadSize) ||
+		(payload[header.payloadSize - 1] != '\0'))
+	{
+		return 1;
+	}
+
+	// Working directory, then arguments (NULL-terminated), then
+	// environment (NULL-terminated).
+	char *at = payload;
+	char *end = payload + header.payloadSize;
+	u32 stringCount = 1 + header.argumentCount + header.environmentCount;
+	char *workingDirectory = NULL;
+	char **arguments = strings;
+	char **environment = strings + header.argumentCount + 1;
+
+	for (u32 i = 0; i < stringCount; ++i)
+	{
+		if (at >= end)
+		{
+			return 1;
+		}
+
+		if (i == 0)
+		{
+			workingDirectory = at;
+		}
+		else if (i <= header.argumentCount)
+		{
+			arguments[i - 1] = at;
+		}
+		else
+		{
+			environment[i - 1 - header.argumentCount] = at;
+		}
+
+		at += strlen(at) + 1;
+	}
+
+	arguments[header.argumentCount] = NULL;
+	environment[header.environmentCount] = NULL;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		dup2(streams[i], i);
+		close(streams[i]);
+	}
+
+	int code = 1;
+
+	if (chdir(workingDirectory) != 0)
+	{
+		char buffer[255];
+		sprintf(buffer, "%s: daemon: could not change directory: %s.\n", ME, strerror(errno));
+		fprintf(stderr, buffer);
+	}
+	else
+	{
+		environ = environment;
+
+		code = handleRequest(header.argumentCount, arguments, data);
+	}
+
+	fflush(NULL);
+
+	i32 exitCode = code;
+	writeAll(connection, &exitCode, sizeof(exitCode));
+
+	return code;
+}
+
+int runDaemon(DaemonRefreshProc *refresh, DaemonRequestProc *handleRequest, void *data)
+{
+	struct sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+
+	if (!getDaemonSocketPath(address.sun_path, sizeof(address.sun_path)))
+	{
+		char buffer[255];
+		sprintf(buffer, "%s: daemon: XDG_RUNTIME_DIR is not set (or too long).\n", ME);
+		fprintf(stderr, buffer);
+
+		return 1;
+	}
+
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (listener == -1)
+	{
+		perror(ME ": daemon: socket");
+		return 1;
+	}
+
+	// 0700 socket: only our user can connect (checked again below).
+	mode_t previousMask = umask(0077);
+	int bindResult = bind(listener, (struct sockaddr *) &address, sizeof(address));
+
+	if ((bindResult == -1) && (errno == EADDRINUSE))
+	{
+		// A socket left by a dead daemon is replaced, a live one is
+		// not.
+		int fd = connectToDaemon(&address);
+
+		if (fd != -1)
+		{
+			close(fd);
+			umask(previousMask);
+
+			char buffer[512];
+			snprintf(buffer, sizeof(buffer), "%s: daemon: already running on '%s'.\n",
+					 ME, address.sun_path);
+			fprintf(stderr, buffer);
+
+			return 1;
+		}
+
+		unlink(address.sun_path);
+		bindResult = bind(listener, (struct sockaddr *) &address, sizeof(address));
+	}
+
+	umask(previousMask);
+
+	if ((bindResult == -1) || (listen(listener, 64) == -1))
+	{
+		perror(ME ": daemon: bind");
+		close(listener);
+
+		return 1;
+	}
+
+	// Children serving requests are not waited for.
+	signal(SIGCHLD, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (;;)
+	{
+		int connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+
+		if (connection == -1)
+		{
+			if ((errno == EINTR) || (errno == ECONNABORTED))
+			{
+				continue;
+			}
+
+			perror(ME ": daemon: accept");
+			break;
+		}
+
+		struct ucred credentials;
+		socklen_t credentialsSize = sizeof(credentials);
+
+		if ((getsockopt(connection, SOL_SOCKET, SO_PEERCRED,
+						&credentials, &credentialsSize) == -1) ||
+			(credentials.uid != getuid()))
+		{
+			close(connection);
+			continue;
+		}
+
+		refresh(data);
+
+		pid_t pid = fork();
+
+		if (pid == 0)
+		{
+			close(listener);
+			_exit(serveRequest(connection, handleRequest, data));
+		}
+		else if (pid == -1)
+		{
+			perror(ME ": daemon: fork");
+		}
+
+		// NOTE: Closing the connection without answering makes the
+		//       client report an error (if fork failed).
+		close(connection);
+	}
+
+	close(listener);
+	unlink(address.sun_path);
+
+	return 1;
+}
@@ -0,0 +1,28 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+#include "xopen_common.h"
+
+// Called by the daemon before serving each request (e.g. to reload
+// the config if it changed). Runs in the daemon itself.
+typedef void DaemonRefreshProc(void *data);
+
+// Handle one request as if it was the main of the client: argv,
+// working directory, environment and standard streams are the
+// client's. Runs in a child of the daemon. Return the exit code.
+typedef int DaemonRequestProc(int argc, char **argv, void *data);
+
+// Get $XDG_RUNTIME_DIR/xopen.sock. Return false if there is no
+// runtime directory.
+b32 getDaemonSocketPath(char *path, size_t pathSize);
+
+// Send this call (argv, working directory, environment and standard
+// streams) to a running daemon and wait for it to be handled.
+// Return false if no daemon could be reached; nothing was done then,
+// the call must be handled in-process.
+b32 forwardToDaemon(int argc, char **argv, int *exitCode);
+
+// Listen on the daemon socket and serve requests until an error
+// occurs. Return the exit code.
+int runDaemon(DaemonRefreshProc *refresh, DaemonRequestProc *handleRequest, void *data);
+
+#endif
@@ -0,0 +1,68 @@
+#include "ef_utils.h"
+#include "entry_list.h"
+
+static void reserveEntry(EntryList *list, size_t length)
+{
+	if (list->count == list->capacity)
+	{
+		list->capacity = list->capacity ? 2 * list->capacity : 1024;
+		list->entries = (Entry *) realloc(list->entries, list->capacity * sizeof(Entry));
+		ASSERT(list->entries);
+	}
+
+	if (list->bytesSize + length + 1 > list->bytesCapacity)
+	{
+		list->bytesCapacity = MAX(2 * list->bytesCapacity, list->bytesSize + length + 1 + 64 * 1024);
+		list->bytes = (char *) realloc(list->bytes, list->bytesCapacity);
+		ASSERT(list->bytes);
+	}
+}
+
+static int pushEntry(EntryList *list, size_t length, EntryType type)
+{
+	Entry *entry = list->entries + list->count;
+
+	entry->offset = list->bytesSize;
+	entry->length = length;
+	entry->type = type;
+	entry->isRemoved = false;
+
+	list->bytes[list->bytesSize + length] = '\0';
+	list->bytesSize += length + 1;
+
+	return list->count++;
+}
+
+int addEntry(EntryList *list, char *path, size_t length, EntryType type)
+{
+	reserveEntry(list, length);
+
+	memcpy(list->bytes + list->bytesSize, path, length);
+
+	return pushEntry(list, length, type);
+}
+
+int addChildEntry(EntryList *list, int parentIndex, char *name, size_t nameLength, EntryType type)
+{
+	size_t parentLength = list->entries[parentIndex].length;
+	size_t length = parentLength + 1 + nameLength;
+
+	// The parent's path must be read after the buffer has grown.
+	reserveEntry(list, length);
+
+	char *path = list->bytes + list->bytesSize;
+
+	memcpy(path, getEntryPath(list, parentIndex), parentLength);
+	path[parentLength] = '/';
+	memcpy(path + parentLength + 1, name, nameLength);
+
+	return pushEntry(list, length, type);
+}
+
+void freeEntryList(EntryList *list)
+{
+	free(list->bytes);
+	free(list->entries);
+
+	*list = {};
+}
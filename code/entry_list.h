@@ -0,0 +1,56 @@
+#ifndef ENTRY_LIST_H
+#define ENTRY_LIST_H
+#include "xopen_common.h"
+
+struct Entry
+{
+	size_t offset;
+	u32 length;
+
+	u8 type;
+	// Removed entries are kept in place (so removing is O(1)) and
+	// skipped when iterating.
+	b32 isRemoved;
+};
+
+// NOTE: Paths are stored one after the other (nul-terminated) in a
+//       single growing buffer, and referred to by offset: pointers
+//       returned by getEntryPath are only valid until the next entry
+//       is added.
+struct EntryList
+{
+	char *bytes;
+	size_t bytesSize;
+	size_t bytesCapacity;
+
+	Entry *entries;
+	int count;
+	int capacity;
+};
+
+// Return the index of the new entry.
+int addEntry(EntryList *list, char *path, size_t length, EntryType type);
+
+// Add "PARENT/name", where PARENT is the path of entry parentIndex.
+int addChildEntry(EntryList *list, int parentIndex, char *name, size_t nameLength, EntryType type);
+
+inline char *getEntryPath(EntryList *list, int index)
+{
+	return list->bytes + list->entries[index].offset;
+}
+
+inline void removeEntry(EntryList *list, int index)
+{
+	list->entries[index].isRemoved = true;
+}
+
+// Remove every entry (keeping memory around for the next ones).
+inline void clearEntryList(EntryList *list)
+{
+	list->count = 0;
+	list->bytesSize = 0;
+}
+
+void freeEntryList(EntryList *list);
+
+#endif
@@ -0,0 +1,323 @@
+#include "ef_utils.h"
+#include "extension_trie.h"
+
+#define SUFFIX_ROOT 0
+#define PREFIX_ROOT 1
+
+enum PatternType
+{
+	Pattern_None,
+	Pattern_Suffix,
+	Pattern_Prefix,
+};
+
+// What has to match, without the '*' (text, length) and which end of
+// the name it is on.
+static PatternType getPattern(char *extension, u32 length, char **text, u32 *textLength)
+{
+	if ((length == 0) ||
+		memchr(extension, '/', length))
+	{
+		return Pattern_None;
+	}
+
+	PatternType type = Pattern_Suffix;
+
+	*text = extension;
+	*textLength = length;
+
+	// Plain extension, see matchExtension.
+	if (!memchr(extension, '.', length) &&
+		!memchr(extension, '*', length))
+	{
+		return Pattern_None;
+	}
+
+	if (extension[0] == '*')
+	{
+		++(*text);
+		--(*textLength);
+	}
+	else if (extension[length - 1] == '*')
+	{
+		--(*textLength);
+		type = Pattern_Prefix;
+	}
+
+	// Only one '*', at either end.
+	if ((*textLength == 0) ||
+		memchr(*text, '*', *textLength))
+	{
+		return Pattern_None;
+	}
+
+	return type;
+}
+
+// NOTE: Fibonacci hashing: the high bits are the mixed ones.
+static inline u32 getEdgeSlot(ExtensionTrie *trie, u32 key)
+{
+	return (key * 2654435769u) >> trie->edgeSlotShift;
+}
+
+static inline u32 getChild(ExtensionTrie *trie, u32 from, u8 character)
+{
+	if (from <= PREFIX_ROOT)
+	{
+		return trie->rootChildren[from][character];
+	}
+
+	u32 key = (from << 8) | character;
+	u32 mask = trie->edgeSlotCount - 1;
+
+	for (u32 slot = getEdgeSlot(trie, key);; slot = (slot + 1) & mask)
+	{
+		TrieEdge *edge = trie->edges + slot;
+
+		if (!edge->to ||
+			(edge->key == key))
+		{
+			return edge->to;
+		}
+	}
+}
+
+static u32 addChild(ExtensionTrie *trie, u32 from, u8 character)
+{
+	u32 child = getChild(trie, from, character);
+
+	if (child)
+	{
+		return child;
+	}
+
+	child = trie->nodeCount++;
+	trie->nodeExtensions[child] = -1;
+
+	if (from <= PREFIX_ROOT)
+	{
+		trie->rootChildren[from][character] = child;
+	}
+	else
+	{
+		u32 key = (from << 8) | character;
+		u32 mask = trie->edgeSlotCount - 1;
+		u32 slot = getEdgeSlot(trie, key);
+
+		while (trie->edges[slot].to)
+		{
+			slot = (slot + 1) & mask;
+		}
+
+		trie->edges[slot] = {key, child};
+	}
+
+	return child;
+}
+
+/*
+  IMPORTANT
+
+  The trie points to table and index: they must outlive it.
+*/
+void buildExtensionTrie(ExtensionTrie *trie, InstructionTable *table, InstructionIndex *index)
+{
+	*trie = {};
+	trie->table = table;
+	trie->index = index;
+
+	// Each character is at most one node (and one edge), + 1 for the
+	// dot of "tar.gz".
+	u32 maxNodeCount = 2;
+
+	for (u32 i = 0; i < table->extensionCount; ++i)
+	{
+		char *text;
+		u32 textLength;
+
+		if (getPattern(getString(table, table->extensions[i]), table->extensions[i].length,
+					   &text, &textLength) != Pattern_None)
+		{
+			maxNodeCount += textLength + 1;
+		}
+	}
+
+	// Node indices take 24 bits of an edge key.
+	ASSERT(maxNodeCount < (1u << 24));
+
+	trie->nodeExtensions = (i32 *) malloc(maxNodeCount * sizeof(i32));
+	ASSERT(trie->nodeExtensions);
+
+	trie->edgeSlotCount = 16;
+	trie->edgeSlotShift = 32 - 4;
+
+	while (trie->edgeSlotCount < 2 * maxNodeCount)
+	{
+		trie->edgeSlotCount <<= 1;
+		--trie->edgeSlotShift;
+	}
+
+	trie->edges = (TrieEdge *) calloc(trie->edgeSlotCount, sizeof(TrieEdge));
+	ASSERT(trie->edges);
+
+	trie->nodeExtensions[SUFFIX_ROOT] = -1;
+	trie->nodeExtensions[PREFIX_ROOT] = -1;
+	trie->nodeCount = 2;
+
+	// NOTE: In config order, so the first extension keeps a node.
+	for (u32 i = 0; i < table->instructionCount; ++i)
+	{
+		Instruction *instruction = table->instructions + i;
+
+		for (u32 extensionIndex = instruction->extensionFirst;
+			 extensionIndex < instruction->extensionFirst + instruction->extensionCount;
+			 ++extensionIndex)
+		{
+			StringRef extension = table->extensions[extensionIndex];
+			char *text;
+			u32 textLength;
+			u32 node;
+
+			switch (getPattern(getString(table, extension), extension.length, &text, &textLength))
+			{
+				case Pattern_Suffix:
+				{
+					node = SUFFIX_ROOT;
+
+					for (u32 c = textLength; c > 0; --c)
+					{
+						node = addChild(trie, node, text[c - 1]);
+					}
+
+					// "tar.gz" follows a dot.
+					if (text == getString(table, extension))
+					{
+						node = addChild(trie, node, '.');
+					}
+
+					break;
+				}
+				case Pattern_Prefix:
+				{
+					node = PREFIX_ROOT;
+
+					for (u32 c = 0; c < textLength; ++c)
+					{
+						node = addChild(trie, node, text[c]);
+					}
+
+					trie->hasPrefixes = true;
+					break;
+				}
+				default:
+				{
+					continue;
+				}
+			}
+
+			if (trie->nodeExtensions[node] == -1)
+			{
+				trie->nodeExtensions[node] = extensionIndex;
+			}
+		}
+	}
+
+	ASSERT(trie->nodeCount <= maxNodeCount);
+}
+
+void freeExtensionTrie(ExtensionTrie *trie)
+{
+	free(trie->nodeExtensions);
+	free(trie->edges);
+	*trie = {};
+}
+
+StringRef *matchExtension(ExtensionTrie *trie, char *path, size_t pathLength)
+{
+	i32 found = -1;
+	size_t foundLength = 0;
+
+	char *end = path + pathLength;
+	char *at = end;
+	char *lastDot = NULL;
+	u32 node = SUFFIX_ROOT;
+
+	// Backward, until the '/' before the name (or a character no
+	// suffix has).
+	while ((at > path) &&
+		   (at[-1] != '/'))
+	{
+		--at;
+
+		if (!lastDot &&
+			(*at == '.'))
+		{
+			lastDot = at;
+		}
+
+		node = getChild(trie, node, (u8) *at);
+
+		if (!node)
+		{
+			break;
+		}
+
+		if (trie->nodeExtensions[node] != -1)
+		{
+			found = trie->nodeExtensions[node];
+			foundLength = end - at;
+		}
+	}
+
+	if (trie->hasPrefixes)
+	{
+		// Start of the name.
+		char *slash = (char *) memrchr(path, '/', at - path);
+
+		at = slash ? slash + 1 : path;
+
+		node = PREFIX_ROOT;
+
+		for (size_t length = 1; at < end; ++at, ++length)
+		{
+			node = getChild(trie, node, (u8) *at);
+
+			if (!node)
+			{
+				break;
+			}
+
+			// Ties go to suffixes.
+			if ((trie->nodeExtensions[node] != -1) &&
+				(length > foundLength))
+			{
+				found = trie->nodeExtensions[node];
+				foundLength = length;
+			}
+		}
+	}
+
+	if (found == -1)
+	{
+		return NULL;
+	}
+
+	// The suffix walk may have stopped before the last dot.
+	for (char *c = end; !lastDot && (c > path) && (c[-1] != '/'); --c)
+	{
+		if (c[-1] == '.')
+		{
+			lastDot = c - 1;
+		}
+	}
+
+	// NOTE: Ties go to the plain extension.
+	if (lastDot &&
+		((size_t) (end - lastDot) >= foundLength) &&
+		getInstructionByExtension(trie->index, lastDot + 1, end - lastDot - 1))
+	{
+		return NULL;
+	}
+
+	return trie->table->extensions + found;
+}
@@ -0,0 +1,63 @@
+#ifndef EXTENSION_TRIE_H
+#define EXTENSION_TRIE_H
+#include "xopen_common.h"
+#include "instruction_table.h"
+#include "instruction_index.h"
+
+/*
+  Extensions of the config are matched against the name of a file (what
+  follows its last '/'):
+
+  pdf           ends with ".pdf" (what a plain extension always meant).
+  tar.gz        ends with ".tar.gz".
+  *.min.js      ends with ".min.js", *rc ends with "rc" (no dot needed).
+  Dockerfile*   starts with "Dockerfile".
+
+  The longest match wins (".tar.gz" over ".gz"), then a plain extension,
+  then the first in the config. Plain extensions (without '.' or '*')
+  are not in the trie: they are looked up from the last dot of the name
+  in the index, like other extensions ("/", "a*b"...).
+*/
+
+struct TrieEdge
+{
+	// (from << 8) | character.
+	u32 key;
+	// 0 if the slot is empty (root nodes are never a child).
+	u32 to;
+};
+
+// NOTE: Suffixes are inserted reversed, so a name is matched with a
+//       single backward pass: each character is one step (one hash
+//       lookup of its edge), whatever the number of extensions.
+struct ExtensionTrie
+{
+	InstructionTable *table;
+	InstructionIndex *index;
+
+	// Node 0 is the root of (reversed) suffixes, node 1 the one of
+	// prefixes. Index in table->extensions of the extension ending on
+	// each node, -1 if none.
+	i32 *nodeExtensions;
+	u32 nodeCount;
+
+	// Children of both roots (first step of every name), 0 if none.
+	u32 rootChildren[2][256];
+
+	// Open addressing (linear probing), a power of two.
+	TrieEdge *edges;
+	u32 edgeSlotCount;
+	u32 edgeSlotShift;
+
+	b32 hasPrefixes;
+};
+
+void buildExtensionTrie(ExtensionTrie *trie, InstructionTable *table, InstructionIndex *index);
+void freeExtensionTrie(ExtensionTrie *trie);
+
+// Return the extension (of trie->table) with a '.' or a '*' matching
+// the name of path, or NULL if none does or if what follows the last
+// dot has an instruction and is as long.
+StringRef *matchExtension(ExtensionTrie *trie, char *path, size_t pathLength);
+
+#endif
@@ -0,0 +1,162 @@
+#include "ef_utils.h"
+#include "instruction_index.h"
+
+#if XOPEN_BAKED
+// Generated by make baked.
+#include "baked_config.h"
+#endif
+
+static u32 getSlotCount(u32 keyCount)
+{
+	// Keep the load factor under 1/2 so probe chains stay short.
+	u32 slotCount = 16;
+
+	while (slotCount < 2 * keyCount)
+	{
+		slotCount <<= 1;
+	}
+
+	return slotCount;
+}
+
+static IndexSlot *makeSlots(u32 slotCount)
+{
+	IndexSlot *slots = (IndexSlot *) malloc(slotCount * sizeof(IndexSlot));
+
+	ASSERT(slots);
+
+	for (u32 i = 0; i < slotCount; ++i)
+	{
+		slots[i].instructionIndex = -1;
+	}
+
+	return slots;
+}
+
+static IndexSlot *findSlot(IndexSlot *slots, u32 slotCount, char *key, size_t keyLength, u32 hash)
+{
+	u32 mask = slotCount - 1;
+	u32 slotIndex = hash & mask;
+
+	for (;;)
+	{
+		IndexSlot *slot = slots + slotIndex;
+
+		if ((slot->instructionIndex == -1) ||
+			((slot->hash == hash) &&
+			 (slot->keyLength == keyLength) &&
+			 (memcmp(slot->key, key, keyLength) == 0)))
+		{
+			return slot;
+		}
+
+		slotIndex = (slotIndex + 1) & mask;
+	}
+}
+
+// NOTE: If the key is already present, the first instruction keeps
+//       it (same behaviour as scanning the instructions in order).
+static void insertKey(IndexSlot *slots, u32 slotCount, char *key, size_t keyLength,
+					  i32 instructionIndex)
+{
+	u32 hash = hashString(key, keyLength);
+	IndexSlot *slot = findSlot(slots, slotCount, key, keyLength, hash);
+
+	if (slot->instructionIndex == -1)
+	{
+		slot->key = key;
+		slot->keyLength = keyLength;
+		slot->hash = hash;
+		slot->instructionIndex = instructionIndex;
+	}
+}
+
+/*
+  IMPORTANT
+
+  Keys point inside of table: it must outlive the index.
+*/
+void buildInstructionIndex(InstructionIndex *index, InstructionTable *table)
+{
+	index->table = table;
+
+	index->extensionSlotCount = getSlotCount(table->extensionCount);
+	index->extensionSlots = makeSlots(index->extensionSlotCount);
+
+	for (u32 i = 0; i < table->instructionCount; ++i)
+	{
+		Instruction *instruction = table->instructions + i;
+		StringRef *extensions = getExtensions(table, instruction);
+
+		for (u32 extensionIndex = 0; extensionIndex < instruction->extensionCount; ++extensionIndex)
+		{
+			insertKey(index->extensionSlots, index->extensionSlotCount,
+					  getString(table, extensions[extensionIndex]),
+					  extensions[extensionIndex].length, i);
+		}
+	}
+}
+
+void freeInstructionIndex(InstructionIndex *index)
+{
+	free(index->extensionSlots);
+	*index = {};
+}
+
+static inline Instruction *getInstruction(InstructionIndex *index, IndexSlot *slots, u32 slotCount,
+										  char *key, size_t keyLength)
+{
+	IndexSlot *slot = findSlot(slots, slotCount, key, keyLength, hashString(key, keyLength));
+
+	return (slot->instructionIndex == -1) ? NULL : index->table->instructions + slot->instructionIndex;
+}
+
+#if XOPEN_BAKED
+/*
+  NOTE
+
+  The arrays of the table are constants of the binary: nothing writes
+  to them (strings of a config were never terminated in place, see
+  instruction_table.h) and loadConfig loads a baked config only once.
+*/
+void loadBakedConfig(InstructionTable *table, InstructionIndex *index)
+{
+	*table = {};
+	table->instructions = (Instruction *) bakedInstructions;
+	table->instructionCount = bakedInstructionCount;
+	table->extensions = (StringRef *) bakedExtensions;
+	table->extensionCount = bakedExtensionCount;
+	table->strings = (char *) bakedStrings;
+	table->stringsSize = bakedStringsSize;
+
+	*index = {};
+	index->table = table;
+}
+
+static inline Instruction *getBakedInstruction(InstructionIndex *index, const PerfectHash *hash,
+											   char *key, size_t keyLength)
+{
+	u64 keyHash = hashPerfectKey(key, keyLength, hash->basis);
+	u32 displacement = hash->displacements[getPerfectHashBucket(hash, keyHash)];
+	const PerfectHashSlot *slot = hash->slots + getPerfectHashSlot(hash, keyHash, displacement);
+
+	if ((slot->instructionIndex == -1) ||
+		(slot->keyLength != keyLength) ||
+		(memcmp(index->table->strings + slot->keyOffset, key, keyLength) != 0))
+	{
+		return NULL;
+	}
+
+	return index->table->instructions + slot->instructionIndex;
+}
+#endif
+
+Instruction *getInstructionByExtension(InstructionIndex *index, char *extension, size_t extensionLength)
+{
+#if XOPEN_BAKED
+	return getBakedInstruction(index, &bakedExtensionHash, extension, extensionLength);
+#else
+	return getInstruction(index, index->extensionSlots, index->extensionSlotCount,
+						  extension, extensionLength);
+#endif
+}
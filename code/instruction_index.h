@@ -0,0 +1,89 @@
+#ifndef INSTRUCTION_INDEX_H
+#define INSTRUCTION_INDEX_H
+#include "xopen_common.h"
+#include "instruction_table.h"
+
+struct IndexSlot
+{
+	char *key;
+	size_t keyLength;
+
+	u32 hash;
+	// -1 if the slot is empty.
+	i32 instructionIndex;
+};
+
+// NOTE: Open-addressing hash tables (linear probing), built once
+//       after the config is loaded. Slot counts are powers of two.
+struct InstructionIndex
+{
+	InstructionTable *table;
+	
+	IndexSlot *extensionSlots;
+	u32 extensionSlotCount;
+};
+
+// NOTE: A baked config (make baked CONFIG=...) has no slots to build:
+//       bake_config (see ../tools/bake_config.cpp) places its keys so
+//       each one is alone in its slot (perfect hash), found with one
+//       probe. The lookups below are the same.
+struct PerfectHashSlot
+{
+	// In InstructionTable::strings.
+	u32 keyOffset;
+	u32 keyLength;
+
+	// -1 if the slot is empty.
+	i32 instructionIndex;
+};
+
+struct PerfectHash
+{
+	// Of FNV-1a (64 bits: keys must not share a hash, see
+	// bake_config.cpp), changed until every key can be placed.
+	u64 basis;
+
+	// Keys of a bucket share a displacement, chosen so they land in
+	// free slots. Both counts are powers of two.
+	u32 bucketShift;
+	u32 slotShift;
+
+	const u32 *displacements;
+	const PerfectHashSlot *slots;
+};
+
+inline u64 hashPerfectKey(char *key, size_t keyLength, u64 basis)
+{
+	u64 hash = basis;
+
+	for (size_t i = 0; i < keyLength; ++i)
+	{
+		hash ^= (u8) key[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+inline u32 getPerfectHashBucket(const PerfectHash *hash, u64 keyHash)
+{
+	return (u32) ((keyHash * 0xff51afd7ed558ccdull) >> hash->bucketShift);
+}
+
+inline u32 getPerfectHashSlot(const PerfectHash *hash, u64 keyHash, u32 displacement)
+{
+	return (u32) (((keyHash ^ displacement) * 11400714819323198485ull) >> hash->slotShift);
+}
+
+void buildInstructionIndex(InstructionIndex *index, InstructionTable *table);
+void freeInstructionIndex(InstructionIndex *index);
+
+#if XOPEN_BAKED
+// table and index are the baked config, never freed.
+void loadBakedConfig(InstructionTable *table, InstructionIndex *index);
+#endif
+
+// Return the first instruction (in config order) with extension, or NULL.
+Instruction *getInstructionByExtension(InstructionIndex *index, char *extension, size_t extensionLength);
+
+#endif
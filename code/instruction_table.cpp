@@ -0,0 +1,255 @@
+#include "ef_utils.h"
+#include "instruction_table.h"
+
+#include <sys/mman.h>
+
+static void growInternSlots(InstructionTable *table, u32 slotCount)
+{
+	u32 *slots = (u32 *) calloc(slotCount, sizeof(u32));
+
+	ASSERT(slots);
+
+	u32 mask = slotCount - 1;
+
+	for (u32 i = 0; i < table->internSlotCount; ++i)
+	{
+		u32 slot = table->internSlots[i];
+
+		if (slot)
+		{
+			char *text = table->strings + (slot - 1);
+			u32 slotIndex = hashString(text, strlen(text)) & mask;
+
+			while (slots[slotIndex])
+			{
+				slotIndex = (slotIndex + 1) & mask;
+			}
+
+			slots[slotIndex] = slot;
+		}
+	}
+
+	free(table->internSlots);
+	table->internSlots = slots;
+	table->internSlotCount = slotCount;
+}
+
+static u32 pushString(InstructionTable *table, char *text, size_t length)
+{
+	if (table->stringsSize + length + 1 > table->stringsCapacity)
+	{
+		while (table->stringsSize + length + 1 > table->stringsCapacity)
+		{
+			table->stringsCapacity = table->stringsCapacity ? 2 * table->stringsCapacity : 4096;
+		}
+
+		table->strings = (char *) realloc(table->strings, table->stringsCapacity);
+		ASSERT(table->strings);
+	}
+
+	u32 offset = table->stringsSize;
+
+	memcpy(table->strings + offset, text, length);
+	table->strings[offset + length] = '\0';
+	table->stringsSize += length + 1;
+
+	return offset;
+}
+
+void initInstructionTable(InstructionTable *table)
+{
+	*table = {};
+
+	pushString(table, "", 0);
+}
+
+void freeInstructionTable(InstructionTable *table)
+{
+	if (table->mapping)
+	{
+		munmap(table->mapping, table->mappingSize);
+	}
+	else
+	{
+		free(table->strings);
+	}
+
+	if (!table->areArraysMapped)
+	{
+		free(table->instructions);
+		free(table->extensions);
+	}
+
+	free(table->internSlots);
+
+	*table = {};
+}
+
+void initInstructionTableFromMapping(InstructionTable *table, char *text, u32 size, size_t mappingSize)
+{
+	*table = {};
+
+	table->strings = text;
+	table->stringsSize = size;
+	table->stringsCapacity = size;
+	table->mapping = text;
+	table->mappingSize = mappingSize;
+}
+
+// NOTE: A config of textSize bytes never needs more: each extension
+//       takes at least 2 bytes of it (with a space). Big allocations
+//       are mapped lazily, unused pages cost nothing.
+void reserveInstructionTable(InstructionTable *table, size_t textSize)
+{
+	u32 extensionCount = (u32) (textSize / 2 + 1);
+
+	if (extensionCount > table->extensionCapacity)
+	{
+		table->extensionCapacity = extensionCount;
+		table->extensions = (StringRef *) realloc(table->extensions,
+												  table->extensionCapacity * sizeof(StringRef));
+		ASSERT(table->extensions);
+	}
+}
+
+StringRef internString(InstructionTable *table, char *text, size_t length)
+{
+	ASSERT(!table->mapping);
+
+	StringRef result = {0, (u32) length};
+
+	if (length == 0)
+	{
+		return result;
+	}
+
+	// Keep the load factor under 1/2.
+	if (2 * (table->internCount + 1) > table->internSlotCount)
+	{
+		growInternSlots(table, table->internSlotCount ? 2 * table->internSlotCount : 256);
+	}
+
+	u32 mask = table->internSlotCount - 1;
+	u32 slotIndex = hashString(text, length) & mask;
+
+	for (;;)
+	{
+		u32 slot = table->internSlots[slotIndex];
+
+		if (!slot)
+		{
+			break;
+		}
+
+		char *interned = table->strings + (slot - 1);
+
+		if ((strncmp(interned, text, length) == 0) && (interned[length] == '\0'))
+		{
+			result.offset = slot - 1;
+			return result;
+		}
+
+		slotIndex = (slotIndex + 1) & mask;
+	}
+
+	result.offset = pushString(table, text, length);
+
+	table->internSlots[slotIndex] = result.offset + 1;
+	++table->internCount;
+
+	return result;
+}
+
+Instruction *addInstruction(InstructionTable *table, StringRef command)
+{
+	if (table->instructionCount == table->instructionCapacity)
+	{
+		table->instructionCapacity = table->instructionCapacity ? 2 * table->instructionCapacity : 64;
+		table->instructions = (Instruction *) realloc(table->instructions,
+													  table->instructionCapacity * sizeof(Instruction));
+		ASSERT(table->instructions);
+	}
+
+	Instruction *instruction = table->instructions + table->instructionCount++;
+
+	instruction->command = command;
+	instruction->tag = {};
+	instruction->extensionFirst = table->extensionCount;
+	instruction->extensionCount = 0;
+
+	return instruction;
+}
+
+void addExtension(InstructionTable *table, StringRef extension)
+{
+	ASSERT(table->instructionCount);
+
+	if (table->extensionCount == table->extensionCapacity)
+	{
+		table->extensionCapacity = table->extensionCapacity ? 2 * table->extensionCapacity : 256;
+		table->extensions = (StringRef *) realloc(table->extensions,
+												  table->extensionCapacity * sizeof(StringRef));
+		ASSERT(table->extensions);
+	}
+
+	table->extensions[table->extensionCount++] = extension;
+	++table->instructions[table->instructionCount - 1].extensionCount;
+}
+
+void removeLastInstruction(InstructionTable *table)
+{
+	ASSERT(table->instructionCount);
+
+	table->extensionCount = table->instructions[--table->instructionCount].extensionFirst;
+}
+
+void finishInstructionTable(InstructionTable *table)
+{
+	free(table->internSlots);
+
+	table->internSlots = NULL;
+	table->internSlotCount = 0;
+	table->internCount = 0;
+}
+
+void copyInstructionTable(InstructionTable *copy, InstructionTable *table)
+{
+	initInstructionTable(copy);
+
+	// Nothing grows while copying.
+	u32 stringCount = 2 * table->instructionCount + table->extensionCount;
+	u32 slotCount = 256;
+
+	while (slotCount < 2 * stringCount)
+	{
+		slotCount <<= 1;
+	}
+
+	growInternSlots(copy, slotCount);
+
+	copy->stringsCapacity = table->stringsSize + 1;
+	copy->strings = (char *) realloc(copy->strings, copy->stringsCapacity);
+	copy->instructionCapacity = table->instructionCount;
+	copy->instructions = (Instruction *) malloc((table->instructionCount + 1) * sizeof(Instruction));
+	copy->extensionCapacity = table->extensionCount;
+	copy->extensions = (StringRef *) malloc((table->extensionCount + 1) * sizeof(StringRef));
+	ASSERT(copy->strings && copy->instructions && copy->extensions);
+
+	for (u32 i = 0; i < table->instructionCount; ++i)
+	{
+		Instruction *instruction = table->instructions + i;
+		StringRef *extensions = getExtensions(table, instruction);
+
+		Instruction *copied = addInstruction(copy, internString(copy, getString(table, instruction->command),
+																 instruction->command.length));
+		copied->tag = internString(copy, getString(table, instruction->tag), instruction->tag.length);
+
+		for (u32 extensionIndex = 0; extensionIndex < instruction->extensionCount; ++extensionIndex)
+		{
+			addExtension(copy, internString(copy, getString(table, extensions[extensionIndex]),
+											extensions[extensionIndex].length));
+		}
+	}
+
+	finishInstructionTable(copy);
+}
@@ -0,0 +1,120 @@
+#ifndef INSTRUCTION_TABLE_H
+#define INSTRUCTION_TABLE_H
+#include "xopen_common.h"
+
+// NOTE: Struct of arrays: the strings of every instruction are in a
+//       single pool and the extensions of all instructions are one
+//       flat array, so there is no limit on the number of rules and a
+//       rule only costs what it uses.
+//
+//       The pool is either the mapping of the config itself (strings
+//       are views into it, see makeInstructionsFromConfig) or interned
+//       strings (see copyInstructionTable).
+//
+// IMPORTANT: Views are not terminated (the config is read-only), use
+//            the length of a string (or copyString).
+struct InstructionTable
+{
+	Instruction *instructions;
+	u32 instructionCount;
+
+	StringRef *extensions;
+	u32 extensionCount;
+
+	// Missing tags are {0, 0}, an empty string (terminated unless the
+	// pool is a config).
+	char *strings;
+	u32 stringsSize;
+
+	// Set when the strings point inside of a mapping instead of being
+	// allocated: of the config, or of the config cache (see
+	// config_cache.cpp) where the arrays are too.
+	void *mapping;
+	size_t mappingSize;
+	b32 areArraysMapped;
+
+	// Only used while building.
+	u32 instructionCapacity;
+	u32 extensionCapacity;
+	u32 stringsCapacity;
+
+	// Intern set: offsets in strings + 1 (0 if the slot is empty).
+	u32 *internSlots;
+	u32 internSlotCount;
+	u32 internCount;
+};
+
+// FNV-1a, of the intern set and the instruction index.
+inline u32 hashString(char *text, size_t length)
+{
+	u32 hash = 2166136261u;
+
+	for (size_t i = 0; i < length; ++i)
+	{
+		hash ^= (u8) text[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+inline char *getString(InstructionTable *table, StringRef string)
+{
+	return table->strings + string.offset;
+}
+
+// Copy string with a '\0', return false if it does not fit in size
+// bytes.
+inline b32 copyString(InstructionTable *table, StringRef string, char *buffer, size_t size)
+{
+	if (string.length >= size)
+	{
+		return false;
+	}
+
+	memcpy(buffer, getString(table, string), string.length);
+	buffer[string.length] = '\0';
+
+	return true;
+}
+
+inline StringRef *getExtensions(InstructionTable *table, Instruction *instruction)
+{
+	return table->extensions + instruction->extensionFirst;
+}
+
+void initInstructionTable(InstructionTable *table);
+void freeInstructionTable(InstructionTable *table);
+
+// The pool is text (size bytes), the start of a mapping of mappingSize
+// bytes which is unmapped with the table.
+void initInstructionTableFromMapping(InstructionTable *table, char *text, u32 size, size_t mappingSize);
+
+// Avoid growing the table while adding what a text of textSize
+// bytes holds.
+void reserveInstructionTable(InstructionTable *table, size_t textSize);
+
+// Return the offset of text in the pool, the same one for equal strings.
+StringRef internString(InstructionTable *table, char *text, size_t length);
+
+// text is inside of the pool.
+inline StringRef getStringView(InstructionTable *table, char *text, size_t length)
+{
+	StringRef result = {(u32) (text - table->strings), (u32) length};
+	return result;
+}
+
+// IMPORTANT: Extensions (and the tag) can only be added to the last
+//            instruction added.
+Instruction *addInstruction(InstructionTable *table, StringRef command);
+void addExtension(InstructionTable *table, StringRef extension);
+
+void removeLastInstruction(InstructionTable *table);
+
+// Free what is only needed while building.
+void finishInstructionTable(InstructionTable *table);
+
+// copy only has the strings table uses (interned).
+void copyInstructionTable(InstructionTable *copy, InstructionTable *table);
+
+#endif
@@ -0,0 +1,612 @@
+#include "ef_utils.h"
+#include "io_batch.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+  NOTE: io_uring is used through its system calls directly (no
+        liburing): only a few operations are needed.
+
+  Each request in flight uses a slot (user_data of its sqe). Reading a
+  header takes three requests in a row on the same slot (open, read,
+  close), so a slot never has more than one sqe queued and the
+  submission queue can not overflow.
+
+  If io_uring_enter fails (ENOMEM, EFAULT...), the ring is not used
+  anymore: the requests the kernel did not take are given back and run
+  like at --io-depth 0, the ones it took are still waited for.
+*/
+
+// NOTE: Setting up a ring costs more than a few stat.
+#define IO_BATCH_MIN_COUNT 8
+
+enum SlotStage
+{
+	SlotStage_Free,
+	SlotStage_Stat,
+	SlotStage_Open,
+	SlotStage_Read,
+	SlotStage_Close,
+};
+
+void initIoBatch(IoBatch *batch, u32 queueDepth)
+{
+	*batch = {};
+	batch->queueDepth = queueDepth;
+	batch->ringFd = -1;
+}
+
+static void releaseRing(IoBatch *batch)
+{
+	if (batch->sqes)
+	{
+		munmap(batch->sqes, batch->sqesSize);
+	}
+
+	if (batch->cqRing && (batch->cqRing != batch->sqRing))
+	{
+		munmap(batch->cqRing, batch->cqRingSize);
+	}
+
+	if (batch->sqRing)
+	{
+		munmap(batch->sqRing, batch->sqRingSize);
+	}
+
+	if (batch->ringFd != -1)
+	{
+		close(batch->ringFd);
+	}
+
+	batch->sqes = NULL;
+	batch->sqRing = batch->cqRing = NULL;
+	batch->ringFd = -1;
+	batch->hasRing = false;
+}
+
+static b32 areOperationsSupported(int ringFd)
+{
+	u8 opcodes[] = {IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE};
+	size_t probeSize = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+	io_uring_probe *probe = (io_uring_probe *) calloc(1, probeSize);
+	ASSERT(probe);
+
+	b32 isSupported = (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, 256) == 0);
+
+	for (size_t i = 0; isSupported && (i < ARRAY_SIZE(opcodes)); ++i)
+	{
+		isSupported = ((opcodes[i] <= probe->last_op) &&
+					   (probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED));
+	}
+
+	free(probe);
+
+	return isSupported;
+}
+
+static b32 setUpRing(IoBatch *batch)
+{
+	io_uring_params params = {};
+
+	batch->ringFd = (int) syscall(__NR_io_uring_setup, batch->queueDepth, &params);
+
+	if (batch->ringFd < 0)
+	{
+		batch->ringFd = -1;
+		return false;
+	}
+
+	if (!areOperationsSupported(batch->ringFd))
+	{
+		releaseRing(batch);
+		return false;
+	}
+
+	batch->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(u32);
+	batch->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	batch->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+	b32 isSingleMap = (params.features & IORING_FEAT_SINGLE_MMAP);
+
+	if (isSingleMap)
+	{
+		batch->sqRingSize = batch->cqRingSize = MAX(batch->sqRingSize, batch->cqRingSize);
+	}
+
+	void *sqRing = mmap(NULL, batch->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+						batch->ringFd, IORING_OFF_SQ_RING);
+	batch->sqRing = (sqRing == MAP_FAILED) ? NULL : sqRing;
+
+	if (batch->sqRing && isSingleMap)
+	{
+		batch->cqRing = batch->sqRing;
+	}
+	else if (batch->sqRing)
+	{
+		void *cqRing = mmap(NULL, batch->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+							batch->ringFd, IORING_OFF_CQ_RING);
+		batch->cqRing = (cqRing == MAP_FAILED) ? NULL : cqRing;
+	}
+
+	if (batch->cqRing)
+	{
+		void *sqes = mmap(NULL, batch->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+						  batch->ringFd, IORING_OFF_SQES);
+		batch->sqes = (sqes == MAP_FAILED) ? NULL : (io_uring_sqe *) sqes;
+	}
+
+	if (!batch->sqes)
+	{
+		releaseRing(batch);
+		return false;
+	}
+
+	u8 *sqBase = (u8 *) batch->sqRing;
+	u8 *cqBase = (u8 *) batch->cqRing;
+
+	batch->sqHead = (u32 *) (sqBase + params.sq_off.head);
+	batch->sqTail = (u32 *) (sqBase + params.sq_off.tail);
+	batch->sqMask = *(u32 *) (sqBase + params.sq_off.ring_mask);
+	batch->sqArray = (u32 *) (sqBase + params.sq_off.array);
+	batch->sqEntryCount = params.sq_entries;
+
+	batch->cqHead = (u32 *) (cqBase + params.cq_off.head);
+	batch->cqTail = (u32 *) (cqBase + params.cq_off.tail);
+	batch->cqMask = *(u32 *) (cqBase + params.cq_off.ring_mask);
+	batch->cqes = (io_uring_cqe *) (cqBase + params.cq_off.cqes);
+
+	// The kernel may round the depth up, never more in flight than
+	// asked though.
+	u32 slotCount = batch->queueDepth;
+
+	batch->statxBuffers = (struct statx *) malloc(slotCount * sizeof(struct statx));
+	batch->slotIndices = (int *) malloc(slotCount * sizeof(int));
+	batch->slotFds = (int *) malloc(slotCount * sizeof(int));
+	batch->slotStages = (u8 *) malloc(slotCount);
+	batch->freeSlots = (int *) malloc(slotCount * sizeof(int));
+	batch->takenBackSlots = (int *) malloc(slotCount * sizeof(int));
+	ASSERT(batch->statxBuffers && batch->slotIndices && batch->slotFds &&
+		   batch->slotStages && batch->freeSlots && batch->takenBackSlots);
+
+	for (u32 slot = 0; slot < slotCount; ++slot)
+	{
+		batch->freeSlots[slot] = slotCount - 1 - slot;
+		batch->slotStages[slot] = SlotStage_Free;
+	}
+
+	batch->freeSlotCount = slotCount;
+
+	return true;
+}
+
+// Set the ring up if the batch is worth it. Return false if requests
+// must be run one after the other.
+static b32 useRing(IoBatch *batch, int requestCount)
+{
+	if (!batch->queueDepth || (requestCount < IO_BATCH_MIN_COUNT))
+	{
+		return batch->hasRing;
+	}
+
+	if (!batch->isSetUp)
+	{
+		batch->isSetUp = true;
+		batch->hasRing = setUpRing(batch);
+	}
+
+	return batch->hasRing;
+}
+
+void freeIoBatch(IoBatch *batch)
+{
+	releaseRing(batch);
+
+	free(batch->statxBuffers);
+	free(batch->slotIndices);
+	free(batch->slotFds);
+	free(batch->slotStages);
+	free(batch->freeSlots);
+	free(batch->takenBackSlots);
+
+	initIoBatch(batch, batch->queueDepth);
+}
+
+static void pushRequest(IoBatch *batch, io_uring_sqe *request)
+{
+	u32 tail = *batch->sqTail;
+
+	// Only one sqe per slot: there is always room.
+	ASSERT(tail - __atomic_load_n(batch->sqHead, __ATOMIC_ACQUIRE) < batch->sqEntryCount);
+
+	u32 index = tail & batch->sqMask;
+
+	batch->sqes[index] = *request;
+	batch->sqArray[index] = index;
+
+	__atomic_store_n(batch->sqTail, tail + 1, __ATOMIC_RELEASE);
+	++batch->unsubmittedCount;
+}
+
+static void freeSlot(IoBatch *batch, int slot)
+{
+	batch->slotStages[slot] = SlotStage_Free;
+	batch->freeSlots[batch->freeSlotCount++] = slot;
+}
+
+// Submit queued requests (none once the ring failed) and wait for at
+// least one to complete. Return false if the ring failed: see
+// takeBackRequests.
+static b32 submitAndWait(IoBatch *batch)
+{
+	for (;;)
+	{
+		long submittedCount = syscall(__NR_io_uring_enter, batch->ringFd, batch->unsubmittedCount, 1,
+									  IORING_ENTER_GETEVENTS, NULL, 0);
+
+		__atomic_add_fetch(&counters.ioSubmitCount, 1, __ATOMIC_RELAXED);
+
+		if (submittedCount >= 0)
+		{
+			batch->unsubmittedCount -= submittedCount;
+			return true;
+		}
+
+		if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY))
+		{
+			batch->hasRing = false;
+			return false;
+		}
+	}
+}
+
+// After submitAndWait failed, put in batch->takenBackSlots the slots
+// of the requests the kernel did not take, and return their count.
+// The caller runs them without the ring and frees their slots.
+//
+// If there are none, the failure was while waiting for the ones the
+// kernel took: the ring is released (which cancels them) and all busy
+// slots are given back.
+static int takeBackRequests(IoBatch *batch)
+{
+	u32 head = __atomic_load_n(batch->sqHead, __ATOMIC_ACQUIRE);
+	u32 tail = *batch->sqTail;
+	int count = 0;
+
+	for (u32 i = head; i != tail; ++i)
+	{
+		batch->takenBackSlots[count++] = (int) batch->sqes[i & batch->sqMask].user_data;
+	}
+
+	// NOTE: The kernel only reads the tail in io_uring_enter, and
+	//       nothing is submitted anymore.
+	__atomic_store_n(batch->sqTail, head, __ATOMIC_RELEASE);
+	batch->unsubmittedCount = 0;
+
+	if (!count)
+	{
+		releaseRing(batch);
+
+		for (u32 slot = 0; slot < batch->queueDepth; ++slot)
+		{
+			if (batch->slotStages[slot] != SlotStage_Free)
+			{
+				batch->takenBackSlots[count++] = (int) slot;
+			}
+		}
+	}
+
+	return count;
+}
+
+static b32 popCompletion(IoBatch *batch, int *slot, i32 *result)
+{
+	u32 head = *batch->cqHead;
+
+	if (head == __atomic_load_n(batch->cqTail, __ATOMIC_ACQUIRE))
+	{
+		return false;
+	}
+
+	io_uring_cqe *completion = batch->cqes + (head & batch->cqMask);
+
+	*slot = (int) completion->user_data;
+	*result = completion->res;
+
+	__atomic_store_n(batch->cqHead, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static u8 statEntryTypeSync(int directoryFd, char *path)
+{
+	struct stat pathStat;
+
+	__atomic_add_fetch(&counters.statCount, 1, __ATOMIC_RELAXED);
+
+	if ((fstatat(directoryFd, path, &pathStat, 0) == 0) &&
+		S_ISDIR(pathStat.st_mode))
+	{
+		return EntryType_Directory;
+	}
+
+	return EntryType_File;
+}
+
+void statEntryTypes(IoBatch *batch, int directoryFd, char **paths, int pathCount, u8 *types)
+{
+	if (!useRing(batch, pathCount))
+	{
+		for (int i = 0; i < pathCount; ++i)
+		{
+			types[i] = statEntryTypeSync(directoryFd, paths[i]);
+		}
+
+		return;
+	}
+
+	int next = 0,
+		inFlightCount = 0;
+
+	while ((next < pathCount) || inFlightCount)
+	{
+		// The ring failed: the rest without it.
+		for (; !batch->hasRing && (next < pathCount); ++next)
+		{
+			types[next] = statEntryTypeSync(directoryFd, paths[next]);
+		}
+
+		while (batch->hasRing && (next < pathCount) && batch->freeSlotCount)
+		{
+			int slot = batch->freeSlots[--batch->freeSlotCount];
+
+			io_uring_sqe request = {};
+			request.opcode = IORING_OP_STATX;
+			request.fd = directoryFd;
+			request.addr = (u64) paths[next];
+			request.len = STATX_TYPE;
+			request.off = (u64) (batch->statxBuffers + slot);
+			request.user_data = slot;
+
+			batch->slotIndices[slot] = next++;
+			batch->slotStages[slot] = SlotStage_Stat;
+			pushRequest(batch, &request);
+			++inFlightCount;
+
+			__atomic_add_fetch(&counters.statCount, 1, __ATOMIC_RELAXED);
+		}
+
+		if (!inFlightCount)
+		{
+			continue;
+		}
+
+		if (!submitAndWait(batch))
+		{
+			int takenBackCount = takeBackRequests(batch);
+
+			for (int i = 0; i < takenBackCount; ++i)
+			{
+				int slot = batch->takenBackSlots[i];
+				int index = batch->slotIndices[slot];
+
+				// NOTE: Counted when queued.
+				types[index] = statEntryTypeSync(directoryFd, paths[index]);
+				__atomic_sub_fetch(&counters.statCount, 1, __ATOMIC_RELAXED);
+
+				freeSlot(batch, slot);
+				--inFlightCount;
+			}
+
+			continue;
+		}
+
+		int slot;
+		i32 result;
+
+		while (popCompletion(batch, &slot, &result))
+		{
+			b32 isDirectory = ((result == 0) && S_ISDIR(batch->statxBuffers[slot].stx_mode));
+
+			types[batch->slotIndices[slot]] = isDirectory ? EntryType_Directory : EntryType_File;
+
+			freeSlot(batch, slot);
+			--inFlightCount;
+		}
+	}
+}
+
+// NOTE: O_NONBLOCK so a FIFO does not block us (it has no effect on
+//       regular files).
+#define HEADER_OPEN_FLAGS (O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK)
+
+static ssize_t readFileHeaderSync(char *path, u8 *header, size_t headerSize)
+{
+	int fd = open(path, HEADER_OPEN_FLAGS);
+
+	if (fd == -1)
+	{
+		return -1;
+	}
+
+	ssize_t size = read(fd, header, headerSize);
+	close(fd);
+
+	return size;
+}
+
+// Run the stages of a slot left from its current one without the ring
+// (taken back, or completed after the ring failed).
+static void finishHeaderSync(IoBatch *batch, int slot, char **paths,
+							 u8 *headers, size_t headerStride, size_t headerSize, ssize_t *sizes)
+{
+	int index = batch->slotIndices[slot];
+	int fd = batch->slotFds[slot];
+
+	switch (batch->slotStages[slot])
+	{
+		case SlotStage_Open:
+		{
+			sizes[index] = readFileHeaderSync(paths[index], headers + index * headerStride, headerSize);
+			break;
+		}
+		case SlotStage_Read:
+		{
+			sizes[index] = pread(fd, headers + index * headerStride, headerSize, 0);
+			close(fd);
+			break;
+		}
+		case SlotStage_Close:
+		{
+			// NOTE: If the ring was released with the close in flight,
+			//       the fd may be closed already (and reused): it is
+			//       left open then.
+			if (batch->ringFd != -1)
+			{
+				close(fd);
+			}
+
+			break;
+		}
+	}
+}
+
+void readFileHeaders(IoBatch *batch, char **paths, int pathCount,
+					 u8 *headers, size_t headerStride, size_t headerSize, ssize_t *sizes)
+{
+	if (!useRing(batch, pathCount))
+	{
+		for (int i = 0; i < pathCount; ++i)
+		{
+			sizes[i] = readFileHeaderSync(paths[i], headers + i * headerStride, headerSize);
+		}
+
+		return;
+	}
+
+	int next = 0,
+		inFlightCount = 0;
+
+	while ((next < pathCount) || inFlightCount)
+	{
+		// The ring failed: the rest without it.
+		for (; !batch->hasRing && (next < pathCount); ++next)
+		{
+			sizes[next] = readFileHeaderSync(paths[next], headers + next * headerStride, headerSize);
+		}
+
+		while (batch->hasRing && (next < pathCount) && batch->freeSlotCount)
+		{
+			int slot = batch->freeSlots[--batch->freeSlotCount];
+
+			io_uring_sqe request = {};
+			request.opcode = IORING_OP_OPENAT;
+			request.fd = AT_FDCWD;
+			request.addr = (u64) paths[next];
+			request.open_flags = HEADER_OPEN_FLAGS;
+			request.user_data = slot;
+
+			batch->slotIndices[slot] = next++;
+			batch->slotStages[slot] = SlotStage_Open;
+			pushRequest(batch, &request);
+			++inFlightCount;
+		}
+
+		if (!inFlightCount)
+		{
+			continue;
+		}
+
+		if (!submitAndWait(batch))
+		{
+			int takenBackCount = takeBackRequests(batch);
+
+			for (int i = 0; i < takenBackCount; ++i)
+			{
+				int slot = batch->takenBackSlots[i];
+
+				finishHeaderSync(batch, slot, paths, headers, headerStride, headerSize, sizes);
+
+				freeSlot(batch, slot);
+				--inFlightCount;
+			}
+
+			continue;
+		}
+
+		int slot;
+		i32 result;
+
+		while (popCompletion(batch, &slot, &result))
+		{
+			int index = batch->slotIndices[slot];
+			io_uring_sqe request = {};
+			request.user_data = slot;
+
+			switch (batch->slotStages[slot])
+			{
+				case SlotStage_Open:
+				{
+					if (result < 0)
+					{
+						sizes[index] = -1;
+
+						freeSlot(batch, slot);
+						--inFlightCount;
+						break;
+					}
+
+					batch->slotFds[slot] = result;
+					batch->slotStages[slot] = SlotStage_Read;
+
+					if (!batch->hasRing)
+					{
+						finishHeaderSync(batch, slot, paths, headers, headerStride, headerSize, sizes);
+
+						freeSlot(batch, slot);
+						--inFlightCount;
+						break;
+					}
+
+					request.opcode = IORING_OP_READ;
+					request.fd = result;
+					request.addr = (u64) (headers + index * headerStride);
+					request.len = headerSize;
+					request.off = 0;
+					pushRequest(batch, &request);
+					break;
+				}
+				case SlotStage_Read:
+				{
+					sizes[index] = (result < 0) ? -1 : result;
+					batch->slotStages[slot] = SlotStage_Close;
+
+					if (!batch->hasRing)
+					{
+						finishHeaderSync(batch, slot, paths, headers, headerStride, headerSize, sizes);
+
+						freeSlot(batch, slot);
+						--inFlightCount;
+						break;
+					}
+
+					request.opcode = IORING_OP_CLOSE;
+					request.fd = batch->slotFds[slot];
+					pushRequest(batch, &request);
+					break;
+				}
+				default:
+				{
+					freeSlot(batch, slot);
+					--inFlightCount;
+					break;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef IO_BATCH_H
+#define IO_BATCH_H
+#include "xopen_common.h"
+
+#include <sys/types.h>
+
+#define DEFAULT_IO_DEPTH 64
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct statx;
+
+// Runs batches of stat and small reads with up to queueDepth of them
+// in flight (io_uring), or one after the other if io_uring is not
+// available (or queueDepth is 0, or the ring fails). Results are the
+// same either way.
+// NOTE: Not thread-safe: one per thread.
+struct IoBatch
+{
+	u32 queueDepth;
+
+	// The ring is only set up for the first batch big enough, and not
+	// used anymore once it fails (see submitAndWait).
+	b32 isSetUp;
+	b32 hasRing;
+	int ringFd;
+
+	u32 *sqHead;
+	u32 *sqTail;
+	u32 sqMask;
+	u32 *sqArray;
+	u32 sqEntryCount;
+	io_uring_sqe *sqes;
+
+	u32 *cqHead;
+	u32 *cqTail;
+	u32 cqMask;
+	io_uring_cqe *cqes;
+
+	void *sqRing;
+	size_t sqRingSize;
+	void *cqRing;
+	size_t cqRingSize;
+	size_t sqesSize;
+
+	u32 unsubmittedCount;
+
+	// One per request in flight.
+	struct statx *statxBuffers;
+	int *slotIndices;
+	int *slotFds;
+	u8 *slotStages;
+	int *freeSlots;
+	int freeSlotCount;
+
+	// Slots given back after the ring failed.
+	int *takenBackSlots;
+};
+
+void initIoBatch(IoBatch *batch, u32 queueDepth);
+void freeIoBatch(IoBatch *batch);
+
+// Type of each path (relative to directoryFd, which can be
+// AT_FDCWD), following symlinks like stat(2). EntryType_File if it
+// can not be stat'ed.
+void statEntryTypes(IoBatch *batch, int directoryFd, char **paths, int pathCount, u8 *types);
+
+// Read up to headerSize bytes at the start of each file, into
+// headers + i * headerStride. sizes[i] is the number of bytes read,
+// -1 if the file could not be read.
+void readFileHeaders(IoBatch *batch, char **paths, int pathCount,
+					 u8 *headers, size_t headerStride, size_t headerSize, ssize_t *sizes);
+
+#endif
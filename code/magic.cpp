@@ -0,0 +1,307 @@
+#include "ef_utils.h"
+#include "magic.h"
+#include "io_batch.h"
+
+#include <pthread.h>
+
+/*
+  Signatures are matched with two masked 64-bit compares each (the 16
+  bytes at their offset), so the header is never scanned byte by byte
+  and there is no memcmp per signature. First match wins: specific
+  signatures come before generic ones sharing their bytes.
+
+  ISO media files (mp4, mov, avif, heic...) all start with "ftyp" at
+  offset 4: the major brand that follows tells them apart, so each
+  format lists the brands it uses.
+
+  A header no signature matches is only scanned when the config has a
+  "txt" line: if it holds no control character (and no NUL), the file
+  is text (README, Makefile, scripts...).
+
+  Files the config could not classify by extension are sniffed, and
+  only if a signature's extension is in the config. So are files whose
+  extension leads to an instruction signatures lead to, when they lead
+  to others as well (a PNG named photo.pdf): a matching signature wins
+  over the extension. When every signature leads to the same
+  instruction, the content can't change it and they are not read.
+*/
+
+struct SignatureSource
+{
+	char *extension;
+	u16 offset;
+	char *bytes;
+	u8 length;
+	// NULL if every byte matters.
+	char *mask;
+};
+
+#define SIGNATURE(extension, offset, bytes) {extension, offset, bytes, sizeof(bytes) - 1, NULL}
+#define MASKED_SIGNATURE(extension, offset, bytes, mask) {extension, offset, bytes, sizeof(bytes) - 1, mask}
+
+static SignatureSource signatureSources[] =
+{
+	SIGNATURE("pdf", 0, "%PDF-"),
+	SIGNATURE("ps", 0, "%!PS"),
+	SIGNATURE("djvu", 0, "AT&TFORM"),
+
+	SIGNATURE("png", 0, "\x89PNG\r\n\x1a\n"),
+	SIGNATURE("jpg", 0, "\xff\xd8\xff"),
+	SIGNATURE("gif", 0, "GIF8"),
+	SIGNATURE("tif", 0, "II*\0"),
+	SIGNATURE("tif", 0, "MM\0*"),
+	MASKED_SIGNATURE("webp", 0, "RIFF\0\0\0\0WEBP", "\xff\xff\xff\xff\0\0\0\0\xff\xff\xff\xff"),
+	SIGNATURE("avif", 4, "ftypavif"),
+	SIGNATURE("avif", 4, "ftypavis"),
+	SIGNATURE("heic", 4, "ftypheic"),
+	SIGNATURE("heic", 4, "ftypheix"),
+	SIGNATURE("heic", 4, "ftypheim"),
+	SIGNATURE("heic", 4, "ftypheis"),
+
+	SIGNATURE("mp4", 4, "ftypisom"),
+	SIGNATURE("mp4", 4, "ftypiso2"),
+	SIGNATURE("mp4", 4, "ftypiso4"),
+	SIGNATURE("mp4", 4, "ftypiso5"),
+	SIGNATURE("mp4", 4, "ftypiso6"),
+	SIGNATURE("mp4", 4, "ftypmp41"),
+	SIGNATURE("mp4", 4, "ftypmp42"),
+	SIGNATURE("mp4", 4, "ftypavc1"),
+	SIGNATURE("mp4", 4, "ftypdash"),
+	SIGNATURE("mp4", 4, "ftypmmp4"),
+	SIGNATURE("mp4", 4, "ftypM4V "),
+	SIGNATURE("mov", 4, "ftypqt  "),
+	SIGNATURE("mkv", 0, "\x1a\x45\xdf\xa3"),
+	MASKED_SIGNATURE("avi", 0, "RIFF\0\0\0\0AVI ", "\xff\xff\xff\xff\0\0\0\0\xff\xff\xff\xff"),
+	MASKED_SIGNATURE("wav", 0, "RIFF\0\0\0\0WAVE", "\xff\xff\xff\xff\0\0\0\0\xff\xff\xff\xff"),
+	SIGNATURE("mp3", 0, "ID3"),
+	SIGNATURE("flac", 0, "fLaC"),
+	SIGNATURE("ogg", 0, "OggS"),
+
+	SIGNATURE("zip", 0, "PK\x03\x04"),
+	SIGNATURE("gz", 0, "\x1f\x8b"),
+	SIGNATURE("bz2", 0, "BZh"),
+	SIGNATURE("xz", 0, "\xfd" "7zXZ\0"),
+	SIGNATURE("7z", 0, "7z\xbc\xaf\x27\x1c"),
+	SIGNATURE("zst", 0, "\x28\xb5\x2f\xfd"),
+	SIGNATURE("rar", 0, "Rar!\x1a\x07"),
+	SIGNATURE("tar", 257, "ustar"),
+
+	SIGNATURE("sqlite", 0, "SQLite format 3\0"),
+};
+
+void buildMagicTable(MagicTable *table, InstructionIndex *index)
+{
+	*table = {};
+	table->signatures = (MagicSignature *) malloc(sizeof(signatureSources));
+	table->instructionTable = index->table;
+	table->sniffedInstructions = (b32 *) calloc(index->table->instructionCount + 1, sizeof(b32));
+	ASSERT(table->signatures && table->sniffedInstructions);
+
+	Instruction *firstInstruction = NULL;
+	b32 isOneInstruction = true;
+
+	for (size_t sourceIndex = 0; sourceIndex < ARRAY_SIZE(signatureSources); ++sourceIndex)
+	{
+		SignatureSource *source = signatureSources + sourceIndex;
+		size_t extensionLength = strlen(source->extension);
+
+		ASSERT(source->length <= 16);
+		ASSERT(source->offset + 16 <= MAGIC_HEADER_SIZE);
+
+		Instruction *instruction = getInstructionByExtension(index, source->extension, extensionLength);
+
+		if (!instruction)
+		{
+			continue;
+		}
+
+		table->sniffedInstructions[instruction - index->table->instructions] = true;
+
+		firstInstruction = firstInstruction ? firstInstruction : instruction;
+		isOneInstruction = isOneInstruction && (instruction == firstInstruction);
+
+		u8 pattern[16] = {},
+		   mask[16] = {};
+
+		for (int i = 0; i < source->length; ++i)
+		{
+			mask[i] = source->mask ? source->mask[i] : 0xff;
+			pattern[i] = source->bytes[i] & mask[i];
+		}
+
+		MagicSignature *signature = table->signatures + table->signatureCount++;
+
+		memcpy(signature->pattern, pattern, sizeof(pattern));
+		memcpy(signature->mask, mask, sizeof(mask));
+		signature->offset = source->offset;
+		signature->end = source->offset + source->length;
+		signature->extension = source->extension;
+		signature->extensionLength = extensionLength;
+	}
+
+	if (isOneInstruction)
+	{
+		memset(table->sniffedInstructions, 0, index->table->instructionCount * sizeof(b32));
+	}
+
+	if (getInstructionByExtension(index, "txt", 3))
+	{
+		table->textExtension = "txt";
+	}
+}
+
+void freeMagicTable(MagicTable *table)
+{
+	free(table->signatures);
+	free(table->sniffedInstructions);
+	*table = {};
+}
+
+// NOTE: Like file(1), text is what has no control character other
+//       than the usual whitespace (and escape). Bytes past 0x7f may be
+//       UTF-8 or another encoding, they are text too.
+static b32 isText(u8 *header, size_t headerSize)
+{
+	for (size_t i = 0; i < headerSize; ++i)
+	{
+		u8 c = header[i];
+
+		if (((c < 0x20) &&
+			 (c != '\t') && (c != '\n') && (c != '\r') && (c != '\f') && (c != '\b') && (c != 0x1b)) ||
+			(c == 0x7f))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+char *matchMagic(MagicTable *table, u8 *header, size_t headerSize)
+{
+	for (int i = 0; i < table->signatureCount; ++i)
+	{
+		MagicSignature *signature = table->signatures + i;
+		u64 bytes[2];
+
+		if (signature->end > headerSize)
+		{
+			continue;
+		}
+
+		memcpy(bytes, header + signature->offset, sizeof(bytes));
+
+		if (((bytes[0] & signature->mask[0]) == signature->pattern[0]) &&
+			((bytes[1] & signature->mask[1]) == signature->pattern[1]))
+		{
+			return signature->extension;
+		}
+	}
+
+	if (table->textExtension &&
+		isText(header, headerSize))
+	{
+		return table->textExtension;
+	}
+
+	return NULL;
+}
+
+// Paths sniffed per batch of reads.
+#define SNIFF_WINDOW_SIZE 1024
+// Padded: signatures read 16 bytes at their offset.
+#define SNIFF_HEADER_STRIDE (MAGIC_HEADER_SIZE + 16)
+
+struct SniffJob
+{
+	MagicTable *table;
+	char **paths;
+	char **extensions;
+	int pathCount;
+	u32 ioDepth;
+
+	pthread_t handle;
+	b32 isStarted;
+};
+
+static void *sniffJobProc(void *parameter)
+{
+	SniffJob *job = (SniffJob *) parameter;
+	int windowSize = MIN(job->pathCount, SNIFF_WINDOW_SIZE);
+	u8 *headers = (u8 *) malloc(windowSize * SNIFF_HEADER_STRIDE);
+	ssize_t *sizes = (ssize_t *) malloc(windowSize * sizeof(ssize_t));
+	ASSERT(headers && sizes);
+
+	IoBatch batch;
+	initIoBatch(&batch, job->ioDepth);
+
+	for (int first = 0; first < job->pathCount; first += windowSize)
+	{
+		int count = MIN(windowSize, job->pathCount - first);
+
+		memset(headers, 0, count * SNIFF_HEADER_STRIDE);
+		readFileHeaders(&batch, job->paths + first, count,
+						headers, SNIFF_HEADER_STRIDE, MAGIC_HEADER_SIZE, sizes);
+
+		__atomic_add_fetch(&counters.sniffCount, count, __ATOMIC_RELAXED);
+
+		for (int i = 0; i < count; ++i)
+		{
+			job->extensions[first + i] = (sizes[i] > 0) ?
+				matchMagic(job->table, headers + i * SNIFF_HEADER_STRIDE, sizes[i]) : NULL;
+		}
+	}
+
+	freeIoBatch(&batch);
+	free(headers);
+	free(sizes);
+
+	return NULL;
+}
+
+void sniffFiles(MagicTable *table, char **paths, int pathCount, int threadCount, u32 ioDepth,
+				char **extensions)
+{
+	// NOTE: Not worth a thread for a few files.
+	int jobCount = MIN(threadCount, pathCount / 64 + 1);
+	SniffJob *jobs = (SniffJob *) calloc(jobCount, sizeof(SniffJob));
+	ASSERT(jobs);
+
+	int first = 0;
+
+	for (int i = 0; i < jobCount; ++i)
+	{
+		int last = (i32) (((i64) pathCount * (i + 1)) / jobCount);
+
+		jobs[i].table = table;
+		jobs[i].paths = paths + first;
+		jobs[i].extensions = extensions + first;
+		jobs[i].pathCount = last - first;
+		jobs[i].ioDepth = ioDepth;
+
+		first = last;
+	}
+
+	// The calling thread does the first job, and those of threads
+	// which could not start.
+	for (int i = 1; i < jobCount; ++i)
+	{
+		jobs[i].isStarted = (pthread_create(&jobs[i].handle, NULL, sniffJobProc, jobs + i) == 0);
+	}
+
+	sniffJobProc(jobs);
+
+	for (int i = 1; i < jobCount; ++i)
+	{
+		if (jobs[i].isStarted)
+		{
+			pthread_join(jobs[i].handle, NULL);
+		}
+		else
+		{
+			sniffJobProc(jobs + i);
+		}
+	}
+
+	free(jobs);
+}
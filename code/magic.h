@@ -0,0 +1,62 @@
+#ifndef MAGIC_H
+#define MAGIC_H
+#include "xopen_common.h"
+#include "instruction_index.h"
+
+// Bytes read at the start of a file to sniff its content.
+#define MAGIC_HEADER_SIZE 512
+
+struct MagicSignature
+{
+	// Bytes [offset, offset + 16[ of the header, masked, must be
+	// equal to pattern (mask is 0 after the signature's length).
+	u64 pattern[2];
+	u64 mask[2];
+	u16 offset;
+	u16 end;
+
+	char *extension;
+	size_t extensionLength;
+};
+
+// NOTE: Only signatures whose extension has an instruction are kept:
+//       if none is (and text is not sniffed), there is nothing to
+//       sniff.
+struct MagicTable
+{
+	MagicSignature *signatures;
+	int signatureCount;
+
+	// "txt" if the config has an instruction for it (files of text
+	// are given to it), NULL otherwise.
+	char *textExtension;
+
+	// One per instruction: true if files it gets by extension are
+	// sniffed too (signatures lead to it and to another instruction:
+	// a misleading extension would change what opens the file).
+	InstructionTable *instructionTable;
+	b32 *sniffedInstructions;
+};
+
+inline b32 isInstructionSniffed(MagicTable *table, Instruction *instruction)
+{
+	return table->sniffedInstructions[instruction - table->instructionTable->instructions];
+}
+
+void buildMagicTable(MagicTable *table, InstructionIndex *index);
+void freeMagicTable(MagicTable *table);
+
+// Return the extension of the first signature matching header (of
+// headerSize bytes, padded with at least 16 bytes), textExtension if
+// none does and header is text, or NULL.
+// NOTE: Only a signature is sure enough to override an extension
+//       which has an instruction, not textExtension.
+char *matchMagic(MagicTable *table, u8 *header, size_t headerSize);
+
+// Read the start of each file and store the extension matching it
+// (or NULL) in extensions, using threadCount threads with up to
+// ioDepth reads in flight each.
+void sniffFiles(MagicTable *table, char **paths, int pathCount, int threadCount, u32 ioDepth,
+				char **extensions);
+
+#endif
@@ -1,5 +1,16 @@
 #include "ef_utils.h"
 #include "config_file_parser.h"
+#include "config_cache.h"
+#include "instruction_index.h"
+#include "extension_trie.h"
+#include "command_path.h"
+#include "walker.h"
+#include "entry_list.h"
+#include "daemon.h"
+#include "bash_worker.h"
+#include "magic.h"
+#include "io_batch.h"
+#include "profile.h"
 
 #include <unistd.h>
 #include <sys/wait.h>
@@ -8,6 +19,10 @@
 #include <string.h>
 #include <getopt.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <pthread.h>
 
 // TODO: - Add options:
 //         --as EXTENSION/TAG: (See tag sytem) open ALL files given with the command associated with the EXTENSION/TAG.
@@ -30,6 +45,10 @@ enum OptionFlag
 	OptionFlag_Recursive					= 1 << 1,
 	OptionFlag_Recursive_Keep_Directories	= 1 << 2,
 	OptionFlag_Only							= 1 << 3,
+	OptionFlag_Rebuild_Cache				= 1 << 4,
+	OptionFlag_Stats						= 1 << 5,
+	OptionFlag_From_Stdin					= 1 << 6,
+	OptionFlag_No_Sniff						= 1 << 7,
 };
 
 
@@ -37,7 +56,10 @@ static char usage[] =
 {
 	"Usage: "
 	ME
-	" FILE [FILE ...] [OPTION ...]\n\n"
+	" FILE [FILE ...] [OPTION ...]\n"
+	"  or:  "
+	ME
+	" -0 [FILE ...] [OPTION ...] < LIST\n\n"
 	"Execute a predefined command based on given files' extension.\n\n"
 	"Syntax of config file is:\n"
 	"CMD - EXTENSION [EXTENSION ...] [@TAG]\n\n"
@@ -68,6 +90,35 @@ static char usage[] =
 	"                    (Default)\n"
 	"  -o, --only EXTENSION/TAG\n"
 	"                    Only execute commands associated with EXTENSION or TAG.\n"
+	"  -j, --jobs N      Use N threads to add sub-directories recursively, and to\n"
+	"                    sniff and classify files.\n"
+	"                    (Default: 1)\n"
+	"      --stats       Print the number of syscalls made (stat, spawn...) on stderr.\n"
+#if XOPEN_PROFILE
+	"      --profile[=FILE]\n"
+	"                    Write the time spent in each phase (config, walk,\n"
+	"                    classify, launch...) as JSON to FILE, or stderr.\n"
+#endif
+	"  -P, --max-procs N Run up to N batches of files at once, and wait for them.\n"
+	"                    (Default: programs are not waited for, functions are\n"
+	"                    run one after the other)\n"
+	"  -0, --from-stdin  Also read files from stdin, separated by NUL (or by\n"
+	"                    newlines if there is none), and handle them by batch.\n"
+	"      --io-depth N  Keep up to N stat/reads in flight (io_uring) for each\n"
+	"                    thread. 0 to make them one after the other.\n"
+	"                    (Default: 64)\n"
+	"      --no-sniff    Do not look at the content of files with an unknown\n"
+	"                    extension (or none) to find their type.\n"
+	"      --rebuild-cache\n"
+	"                    Parse the config file (and extract ~/.bashrc functions)\n"
+	"                    even if their cache is up to date.\n"
+	"      --daemon      Keep the config loaded and handle other calls sent to\n"
+	"                    $XDG_RUNTIME_DIR/"
+	ME
+	".sock (same as running "
+	ME
+	"d).\n"
+	"      --no-daemon   Do not send this call to a running daemon.\n"
 };
 
 // NOTE: This part can be reused.
@@ -83,6 +134,8 @@ static char version[] =
 	"as published by Sam Hocevar. See http://www.wtfpl.net/ for more details.\n"
 };
 
+Counters counters = {};
+
 
 // Copy output of pipe_fd to buffer. Remove trailing newline if any.
 static inline int copyOutput(int pipe_fd[2], char *buffer, int bufferSize)
@@ -106,17 +159,22 @@ static inline int copyOutput(int pipe_fd[2], char *buffer, int bufferSize)
 /* Exec command with args (commandPath is absolute, args[0] must be
    the command name).
    Store child's status code in statusCode if not in background.
+   Store child's pid in childPid (if any).
    Store child's stdout in stdoutBuffer (if any).
    Store parent or child's stderr in stderrBuffer (if any).
  
    Return < 0 if error on parent's part.
           > 0 if error on child's part.
           = 0 otherwhise.
+
+   The child is started with posix_spawn (vfork-like: the parent's
+   page tables are not copied). Pipes are only created for the
+   buffers given, so background launches do not create any.
 */
 static int childExec(char *commandPath, char *args[], int *statusCode = NULL,
 					 char *stdoutBuffer = NULL, int stdoutBufferSize = 0,
 					 char *stderrBuffer = NULL, int stderrBufferSize = 0,
-					 b32 inBackground = false)
+					 b32 inBackground = false, pid_t *childPid = NULL)
 {
 	// NOTE: Using macros for this is totally unnecessary.
 	//       But it's fun!
@@ -124,7 +182,7 @@ static int childExec(char *commandPath, char *args[], int *statusCode = NULL,
 	{																	\
 		if (JOIN(stream, Buffer))										\
 		{																\
-			if (pipe(JOIN(pipe_, stream)) == -1)						\
+			if (pipe2(JOIN(pipe_, stream), O_CLOEXEC) == -1)			\
 			{															\
 				if (stderrBuffer)										\
 				{														\
@@ -137,14 +195,23 @@ static int childExec(char *commandPath, char *args[], int *statusCode = NULL,
 		}																\
 	} while(0)
 
-#define DUP_STREAM(stream, alias) do				\
-	{												\
-		if (JOIN(stream, Buffer))					\
-		{											\
-			dup2(JOIN(pipe_, stream)[1], alias);	\
-			close(JOIN(pipe_, stream)[0]);			\
-			close(JOIN(pipe_, stream)[1]);			\
-		}											\
+	// NOTE: Both ends of the pipe are close-on-exec, only the dup'ed
+	//       descriptor stays open in the child.
+#define DUP_STREAM(stream, alias) do									\
+	{																	\
+		if (JOIN(stream, Buffer))										\
+		{																\
+			posix_spawn_file_actions_adddup2(&fileActions, JOIN(pipe_, stream)[1], alias); \
+		}																\
+	} while(0)
+
+#define CLOSE_STREAM(stream) do											\
+	{																	\
+		if (JOIN(stream, Buffer))										\
+		{																\
+			close(JOIN(pipe_, stream)[0]);								\
+			close(JOIN(pipe_, stream)[1]);								\
+		}																\
 	} while(0)
 
 #define COPY_STREAM(stream) do											\
@@ -161,56 +228,101 @@ static int childExec(char *commandPath, char *args[], int *statusCode = NULL,
 	PIPE_STREAM(stderr, -1);
 	PIPE_STREAM(stdout, -2);
 
-	switch(fork())
+	b32 hasFileActions = (stdoutBuffer || stderrBuffer);
+	posix_spawn_file_actions_t fileActions;
+
+	if (hasFileActions)
 	{
-		case -1:
-		{
-			if (stderrBuffer)
-			{
-				char buffer[255];
-				sprintf(buffer, "%s: unable to start child process.\n", ME);
-				strncpy(stderrBuffer, buffer, stderrBufferSize);
-			}
+		posix_spawn_file_actions_init(&fileActions);
+		
+		DUP_STREAM(stderr, STDERR_FILENO);
+		DUP_STREAM(stdout, STDOUT_FILENO);
+	}
+
+	pid_t pid;
+	int error = posix_spawn(&pid, commandPath, hasFileActions ? &fileActions : NULL,
+							NULL, args, environ);
+
+	if (hasFileActions)
+	{
+		posix_spawn_file_actions_destroy(&fileActions);
+	}
+
+	if (error)
+	{
+		CLOSE_STREAM(stderr);
+		CLOSE_STREAM(stdout);
+
+		char buffer[255];
+
+		// NOTE: The child could not exec commandPath (posix_spawn
+		//       reports it), that's an error on the child's part.
+		//       Anything else means it could not be started.
+		b32 isExecError = ((error == ENOENT) || (error == EACCES) || (error == ENOEXEC) ||
+						   (error == E2BIG) || (error == ENOTDIR) || (error == ELOOP));
 
-			return -3;
+		if (isExecError)
+		{
+			snprintf(buffer, sizeof(buffer), "%s: failed to execute %s: %s.\n",
+					 ME, args[0], strerror(error));
+		}
+		else
+		{
+			snprintf(buffer, sizeof(buffer), "%s: unable to start child process.\n", ME);
 		}
-		case 0:
+
+		if (stderrBuffer)
 		{
-			DUP_STREAM(stderr, STDERR_FILENO);
-			DUP_STREAM(stdout, STDOUT_FILENO);
-			
-			execv(commandPath, args);
-			
-			char buffer[255];
-			sprintf(buffer, "%s: failed to execute %s.\n", ME, args[0]);
-			perror(buffer);
-			
-			return 1;
+			strncpy(stderrBuffer, buffer, stderrBufferSize);
 		}
-		default:
+		else
 		{
-			COPY_STREAM(stderr);
-			COPY_STREAM(stdout);
+			fprintf(stderr, "%s", buffer);
+		}
 
-			if (!inBackground)
-			{
-				wait(statusCode);
-			}
+		return isExecError ? 1 : -3;
+	}
 
-			break;
-		}
+	++counters.spawnCount;
+
+	COPY_STREAM(stderr);
+	COPY_STREAM(stdout);
+
+	if (childPid)
+	{
+		*childPid = pid;
+	}
+
+	// Only wait for this one (not for children started in
+	// background).
+	if (!inBackground)
+	{
+		waitpid(pid, statusCode, 0);
 	}
 
 #undef PIPE_STREAM
 #undef DUP_STREAM
+#undef CLOSE_STREAM
 #undef COPY_STREAM
 	
 	return 0;
 }
 
-static void getFileExtension(char *file, char *extension)
+// NOTE: The extension is the longest one of the config the file name
+//       matches (see extension_trie.h), or what follows its last dot.
+static void getFileExtension(ExtensionTrie *trie, char *file, char *extension)
 {
-	char *fileOffset = file + strlen(file) - 1;
+	size_t fileLength = strlen(file);
+	StringRef *match = matchExtension(trie, file, fileLength);
+
+	if (match &&
+		(match->length < 64))
+	{
+		copyString(trie->table, *match, extension, 64);
+		return;
+	}
+
+	char *fileOffset = file + fileLength - 1;
 	
 	// Put offset on last dot (or slash, as it can no longer be an
 	// extension).
@@ -232,41 +344,26 @@ static void getFileExtension(char *file, char *extension)
 	}
 }
 
-static void getExtension(char *entry, char *extension)
+// NOTE: An unknown entryType is taken as a file.
+static void getExtension(ExtensionTrie *trie, char *entry, EntryType entryType, char *extension)
 {
-	struct stat entryStat;
-	stat(entry, &entryStat);
-
 	// Extension for directories is '/' (as it's both
 	// meaningful and impossible to have).
-	if (S_ISDIR(entryStat.st_mode))
+	if (entryType == EntryType_Directory)
 	{
 		extension[0] = '/'; extension[1] = '\0';
 		return;
 	}
 
-	getFileExtension(entry, extension);
-}
-
-static b32 instructionHasExtension(Instruction *instruction, char *extension, size_t extensionLength)
-{
-	for (int extensionIndex = 0; extensionIndex < instruction->extensionCount; ++extensionIndex)
-	{
-		if ((instruction->extensionsLength[extensionIndex] == extensionLength) &&
-			(strncmp(extension, instruction->extensions[extensionIndex], extensionLength) == 0))
-		{
-			return true;
-		}
-	}
-
-	return false;
+	getFileExtension(trie, entry, extension);
 }
 
-static inline b32 instructionHasTag(Instruction *instruction, char *tag, size_t tagLength)
+static inline b32 instructionHasTag(InstructionTable *table, Instruction *instruction,
+										char *tag, size_t tagLength)
 {
 	if ((tagLength > 0) &&
-		(instruction->tagLength == tagLength) &&
-		(strncmp(tag, instruction->tag, tagLength) == 0))
+		(instruction->tag.length == tagLength) &&
+		(strncmp(tag, getString(table, instruction->tag), tagLength) == 0))
 	{
 		return true;
 	}
@@ -274,510 +371,1666 @@ static inline b32 instructionHasTag(Instruction *instruction, char *tag, size_t
 	return false;
 }
 
-static Instruction *getInstructionByExtension(char *extension, size_t extensionLength,
-											  Instruction *allInstructions, int instructionCount)
+// Entries given to an instruction for the current batch.
+struct ArgumentList
 {
-	Instruction *instruction = allInstructions;
-	
-	for (int index = 0; index < instructionCount; ++index)
+	// NOTE: Grown as needed (see addArgument), freed with the context.
+	char **arguments;
+	int count;
+	int capacity;
+};
+
+// State shared by every batch of entries.
+struct Context
+{
+	i32 optionFlags;
+	int jobCount;
+	u32 ioDepth;
+
+	// 0 if batches are not limited (programs are started in
+	// background and not waited for, functions one after the
+	// other).
+	int maxProcessCount;
+	int runningProcessCount;
+
+	// Runs functions (each busy worker counts as a running batch).
+	BashPool bashPool;
+
+	// Stats types readdir did not give (see io_batch.h).
+	IoBatch ioBatch;
+
+	char (*onlyArray)[64];
+	size_t *onlyArrayLength;
+	int onlyArrayCount;
+
+	InstructionTable *instructionTable;
+	Instruction *defaultInstruction;
+	InstructionIndex instructionIndex;
+	ExtensionTrie *extensionTrie;
+	MagicTable *magicTable;
+
+	// One per instruction of instructionTable.
+	ArgumentList *argumentLists;
+};
+
+// stat(2) the entries of entryIndices, all at once.
+static void statEntries(Context *context, EntryList *entryList, int *entryIndices, int count)
+{
+	if (!count)
 	{
-		if (instructionHasExtension(instruction, extension, extensionLength))
-		{
-			return instruction;
-		}
-		
-		++instruction;
+		return;
 	}
 
-	return NULL;
+	char **paths = (char **) malloc(count * sizeof(char *));
+	u8 *types = (u8 *) malloc(count);
+	ASSERT(paths && types);
+
+	for (int i = 0; i < count; ++i)
+	{
+		paths[i] = getEntryPath(entryList, entryIndices[i]);
+	}
+
+	statEntryTypes(&context->ioBatch, AT_FDCWD, paths, count, types);
+
+	for (int i = 0; i < count; ++i)
+	{
+		entryList->entries[entryIndices[i]].type = types[i];
+	}
+
+	free(paths);
+	free(types);
 }
 
-static Instruction *getInstructionByTag(char *tag, size_t tagLength,
-										Instruction *allInstructions, int instructionCount)
+// stat(2) entries [first, last[ whose type is still unknown, all at
+// once.
+static void statUnknownEntries(Context *context, EntryList *entryList, int first, int last)
 {
-	Instruction *instruction = allInstructions;
-	
-	for (int index = 0; index < instructionCount; ++index)
+	int *entryIndices = (int *) malloc((last - first + 1) * sizeof(int));
+	ASSERT(entryIndices);
+
+	int unknownCount = 0;
+
+	for (int i = first; i < last; ++i)
 	{
-		if (instructionHasTag(instruction, tag, tagLength))
+		if (!entryList->entries[i].isRemoved &&
+			(entryList->entries[i].type == EntryType_Unknown))
 		{
-			return instruction;
+			entryIndices[unknownCount++] = i;
 		}
-		
-		++instruction;
 	}
 
-	return NULL;
+	statEntries(context, entryList, entryIndices, unknownCount);
+
+	free(entryIndices);
 }
 
-int main(int argc, char* argv[])
+// Replace directories in entryList by their content (recursively)
+// if asked to.
+static void addSubDirectories(Context *context, EntryList *entryList)
 {
-	// NOTE: This part can be reused.
-	char configFile[255];
-	char *homeDir = NULL;
+	b32 keepDirectories = (context->optionFlags & OptionFlag_Recursive_Keep_Directories);
 	
-	if ((homeDir = getenv("XDG_CONFIG_HOME")) != NULL)
-	{
-		sprintf(configFile, "%s/%s.conf", homeDir, ME);
-	}
-	else if (((homeDir = getenv("HOME")) != NULL) ||
-			 ((homeDir = getpwuid(getuid())->pw_dir) != NULL))
-	{
-		sprintf(configFile, "%s/.config/%s.conf", homeDir, ME);
-	}
-	else
+	// Add sub-directories recursively.
+	if (((context->optionFlags & OptionFlag_Recursive) || keepDirectories) &&
+		(context->jobCount > 1))
 	{
-		char buffer[255];
-		sprintf(buffer, "%s: could not create config file: no home directory found.\n", ME);
-		fprintf(stderr, buffer);
- 
-		return -1;
-	}
-	
-	FILE *handle = fopen(configFile, "a+");
+		int rootCount = entryList->count;
+		char **directories = (char **) malloc(rootCount * sizeof(char *));
+		int directoryCount = 0;
 
-	if (handle == NULL)
-	{
-		char buffer[255];
-		sprintf(buffer, "%s: could not read config file '%s'.\n", ME, configFile);
-		fprintf(stderr, buffer);
+		ASSERT(directories);
 
-		return -2;
-	}
-	
-	fclose(handle);
-	
-	int helpFlag = 0,
-		versionFlag = 0;
-	
-	char onlyArray[10][64];
-	size_t onlyArrayLength[10];
-	int onlyArrayCount = 0;
-	
-	i32 optionFlags = OptionFlag_None;
+		statUnknownEntries(context, entryList, 0, rootCount);
 
-	// NOTE: I will probably have to parse the command line myself, as
-	//       getopt does not support multiple arguments for given option.
-	static struct option longOptions[] =
+		for (int i = 0; i < rootCount; ++i)
 		{
-			{"help"							, no_argument, &helpFlag, 1},
-			{"version"						, no_argument, &versionFlag, 1},
-			{"which"						, no_argument, 0, 'w'},
-			{"execute"						, no_argument, 0, 'e'},
-			{"recursive"					, no_argument, 0, 'r'},
-			{"recursive-keep-directories"	, no_argument, 0, 'R'},
-			{"directory"					, no_argument, 0, 'd'},
-			{"only"							, required_argument, 0, 'o'},
-			{0								, 0, 0, 0}
-		};
-			
-	int c;
-	
-	for(;;)
-	{
-		int optionIndex = 0;
-		
-		// I'll add an 'i' soon.
-		// Promised.
-		c = getopt_long(argc, argv, "werRdo:", longOptions, &optionIndex);
+			Entry *entry = entryList->entries + i;
 
-		if (c == -1)
-		{
-			break;
-		}
-			
-		switch (c)
-		{
-			case 0:
+			if (entry->type == EntryType_Directory)
 			{
-				if (longOptions[optionIndex].flag != 0)
+				directories[directoryCount++] = getEntryPath(entryList, i);
+
+				// Directories given are replaced by their content.
+				if (!keepDirectories)
 				{
-					break;
+					removeEntry(entryList, i);
 				}
-				// printf("option %s\n", longOptions[optionIndex].name);
-				// return 0;
-			}
-			case 'w':
-			{
-				optionFlags |= OptionFlag_Which;
-				break;
-			}
-			case 'e':
-			{
-				optionFlags &= ~OptionFlag_Which;
-				break;
 			}
-			case 'r':
-			{
-				optionFlags &= ~OptionFlag_Recursive_Keep_Directories;
-				optionFlags |= OptionFlag_Recursive;
-				break;
-			}
-			case 'R':
+		}
+
+		WalkOutput output;
+		walkDirectories(directories, directoryCount, context->jobCount, context->ioDepth,
+						keepDirectories, &output);
+
+		free(directories);
+
+		char *path = output.paths;
+
+		for (int i = 0; i < output.count; ++i)
+		{
+			size_t length = strlen(path);
+
+			addEntry(entryList, path, length, (EntryType) output.types[i]);
+			path += length + 1;
+		}
+
+		freeWalkOutput(&output);
+	}
+	else if ((context->optionFlags & OptionFlag_Recursive) || keepDirectories)
+	{
+		statUnknownEntries(context, entryList, 0, entryList->count);
+
+		// NOTE: entryList->count grows while sub-directories are
+		//       added, so they are walked as well.
+		for (int i = 0; i < entryList->count; ++i)
+		{
+			Entry *entry = entryList->entries + i;
+
+			if (entry->type != EntryType_Directory)
 			{
-				optionFlags &= ~OptionFlag_Recursive;
-				optionFlags |= OptionFlag_Recursive_Keep_Directories;
-				break;
+				continue;
 			}
-			case 'd':
+
+			if (!keepDirectories)
 			{
-				optionFlags &= ~OptionFlag_Recursive;
-				break;
+				removeEntry(entryList, i);
 			}
-			case 'o':
+
+			DIR *d = opendir(getEntryPath(entryList, i));
+			struct dirent *dir;
+
+			++counters.opendirCount;
+
+			if (d)
 			{
-				optionFlags |= OptionFlag_Only;
-				size_t length = strlen(optarg);
-				
-				if (length >= ARRAY_SIZE(onlyArray[0]))
-				{
-					char buffer[255];
+				int firstChild = entryList->count;
 
-					sprintf(buffer, "%s: -o/--only: %s is too long (> %d characters).\n",
-							ME, optarg, (i32) ARRAY_SIZE(onlyArray[0]) - 1);
-					fprintf(stderr, buffer);
+				while ((dir = readdir(d)) != NULL)
+				{
+					// Current and previous directory.
+					if ((strcmp(dir->d_name, ".") == 0) ||
+						(strcmp(dir->d_name, "..") == 0))
+					{
+						continue;
+					}
 
-					return -1;
+					addChildEntry(entryList, i, dir->d_name, strlen(dir->d_name),
+								  getDirentEntryType(dir));
 				}
-				
-				onlyArrayLength[onlyArrayCount] = length;
-				strcpy(onlyArray[onlyArrayCount++], optarg);
-				
-				break;
-			}
-			default:
-			{
-				return -1;
-				break;
+
+				closedir(d);
+
+				// Children readdir did not give the type of.
+				statUnknownEntries(context, entryList, firstChild, entryList->count);
 			}
 		}
 	}
+}
 
-	if (helpFlag)
+static void addArgument(ArgumentList *list, char *argument)
+{
+	if (list->count == list->capacity)
 	{
-		printf("%s", usage);
-		return 0;
+		list->capacity = list->capacity ? 2 * list->capacity : 64;
+		list->arguments = (char **) realloc(list->arguments, list->capacity * sizeof(char *));
+		ASSERT(list->arguments);
 	}
 
-	if (versionFlag)
+	list->arguments[list->count++] = argument;
+}
+
+static void addArguments(ArgumentList *list, char **arguments, int count)
+{
+	if (list->count + count > list->capacity)
 	{
-		printf("%s", version);
-		return 0;
+		while (list->count + count > list->capacity)
+		{
+			list->capacity = list->capacity ? 2 * list->capacity : 64;
+		}
+
+		list->arguments = (char **) realloc(list->arguments, list->capacity * sizeof(char *));
+		ASSERT(list->arguments);
 	}
 
-	// TODO: Properly get the number of entries.
-	char allEntries[1024][255];
-	int entryCount = 0;
+	memcpy(list->arguments + list->count, arguments, count * sizeof(char *));
+	list->count += count;
+}
 
-	entryCount = argc - optind;
+// NOTE: An entry whose type is still unknown is taken as a file (see
+//       statNeededEntries).
+static void getEntryExtension(Context *context, EntryList *entryList, int entryIndex, char *extension)
+{
+	Entry *entry = entryList->entries + entryIndex;
 
-	if (entryCount <= 0)
+	// No directory if --recursive is set.
+	if (context->optionFlags & OptionFlag_Recursive)
 	{
-		char buffer[255];
-		sprintf(buffer, "%s: no file given.\n", ME);
-		fprintf(stderr, buffer);
-
-		return 1;
+		getFileExtension(context->extensionTrie, getEntryPath(entryList, entryIndex), extension);
+		return;
 	}
 
-	// TODO: If onlyArgs:
-	//       - Move instruction creation here.
-	//       - For each argv left:
-	//         If directory:
-	//           - If recursive, add content.
-	//           - If recursive and keep, add content BUT go to file part.
-	//         If file:
-	//           - Treat onlyArg element as extension:
-	//             - If file same extension, add file.
-	//             - If any file added, skip following step.
-	//           - Treat onlyArg element as tag:
-	//             - Get instruction by tag.
-	//             - If file extension in instruction extensions, add file.
-	//       - Save current index.
-	//       - Do same on recursive add, as soon as i == current index.
-	//
-	//       - Go to exectute (or make a function exectuteInstructions).
+	getExtension(context->extensionTrie, getEntryPath(entryList, entryIndex), (EntryType) entry->type, extension);
+}
+
+// Instruction of entries of that extension (the default one if it has
+// none), NULL if there is neither. toSkip is set if --only leaves them
+// out.
+static Instruction *getEntryInstruction(Context *context, char *extension, size_t extensionLength,
+										b32 *toSkip)
+{
+	*toSkip = false;
 
-	// Copy entries given from argv.
-	for (int i = 0; i < entryCount; ++i)
+	if (context->onlyArrayCount)
 	{
-		strcpy(allEntries[i], argv[optind + i]);
+		*toSkip = true;
+
+		// Extension explicitly asked.
+		for (int index = 0; index < context->onlyArrayCount; ++index)
+		{
+			if ((extensionLength == context->onlyArrayLength[index]) &&
+				(strncmp(extension, context->onlyArray[index], extensionLength) == 0))
+			{
+				*toSkip = false;
+			}
+		}
+	}
+
+	Instruction *instruction = getInstructionByExtension(&context->instructionIndex, extension, extensionLength);
 
-		int indexLastChar = strlen(allEntries[i]) - 1;
+	if (!instruction)
+	{
+		instruction = context->defaultInstruction;
+	}
 
-		if ((indexLastChar > 0)
-			&& allEntries[i][indexLastChar] == '/')
+	if (instruction &&
+		*toSkip)
+	{
+		for (int index = 0; index < context->onlyArrayCount; ++index)
 		{
-			allEntries[i][indexLastChar] = '\0';
+			if (instructionHasTag(context->instructionTable, instruction,
+								  context->onlyArray[index], context->onlyArrayLength[index]))
+			{
+				*toSkip = false;
+			}
 		}
 	}
 
-	// Add sub-directories recursively.
-	if ((optionFlags & OptionFlag_Recursive) ||
-		(optionFlags & OptionFlag_Recursive_Keep_Directories))
+	return instruction;
+}
+
+/*
+  NOTE
+
+  The type of an entry only tells its extension: '/' for a directory,
+  its name's for anything else. When both lead to the same instruction
+  (no '/' rule and a default one, say), or are both left out by
+  --only, the type can't change what is done with the entry and it is
+  not stat'ed: it is classified by its name. A directory left unknown
+  may then be sniffed (see sniffUnclassifiedEntries), which finds
+  nothing in it, and it ends up where its name leads, as a directory
+  would have.
+
+  Types given by readdir or by a trailing '/' are already known.
+*/
+static void statNeededEntries(Context *context, EntryList *entryList)
+{
+	int *entryIndices = (int *) malloc((entryList->count + 1) * sizeof(int));
+	ASSERT(entryIndices);
+
+	int neededCount = 0;
+	u64 avoidedCount = 0;
+
+	b32 directoryToSkip;
+	Instruction *directoryInstruction = getEntryInstruction(context, (char *) "/", 1, &directoryToSkip);
+
+	// Unmatched directories and files are reported with their
+	// extension: nothing to avoid.
+	b32 canAvoid = (directoryInstruction || directoryToSkip);
+
+	for (int i = 0; i < entryList->count; ++i)
 	{
-		int i = 0;
-		
-		while(i != entryCount)
+		if (entryList->entries[i].isRemoved ||
+			(entryList->entries[i].type != EntryType_Unknown))
+		{
+			continue;
+		}
+
+		if (canAvoid)
 		{
-			char *entry = allEntries[i];
-			struct stat entryStat;
-			stat(entry, &entryStat);
+			char extension[64];
+			b32 toSkip;
+
+			getFileExtension(context->extensionTrie, getEntryPath(entryList, i), extension);
 
-			if (S_ISDIR(entryStat.st_mode))
+			Instruction *instruction = getEntryInstruction(context, extension, strlen(extension), &toSkip);
+
+			if ((toSkip && directoryToSkip) ||
+				(!toSkip && !directoryToSkip && instruction && (instruction == directoryInstruction)))
 			{
-				DIR *d;
-				struct dirent *dir;
-				char dirPath[255];
-				strcpy(dirPath, entry);
+				++avoidedCount;
+				continue;
+			}
+		}
 
-				if (!(optionFlags & OptionFlag_Recursive_Keep_Directories))
-				{
-					// Remove the directory from the list and move
-					// following entries one entry back.
-					memcpy(allEntries + i, allEntries + i + 1,
-						   (entryCount - i - 1) * sizeof(char) * ARRAY_SIZE(allEntries[0]));
-					--entryCount;
-					--i;
-				}
+		entryIndices[neededCount++] = i;
+	}
 
-				d = opendir(dirPath);
+	statEntries(context, entryList, entryIndices, neededCount);
 
-				if (d)
-				{
-					while ((dir = readdir(d)) != NULL)
-					{
-						ASSERT(entryCount + 1 < (i32) ARRAY_SIZE(allEntries));
-
-						// Current and previous directory.
-						if ((strcmp(dir->d_name, ".") == 0) ||
-							(strcmp(dir->d_name, "..") == 0))
-						{
-							continue;
-						}
-
-						char buffer[255];
-						sprintf(buffer, "%s/%s", dirPath, dir->d_name);
-						
-						strcpy(allEntries[entryCount++], buffer);
-					}
+	counters.statAvoidedCount += avoidedCount;
 
-					closedir(d);
-				}
-			}
+	free(entryIndices);
+}
 
-			++i;
-		}
+// Entries a classify job takes at least (fewer are not worth a
+// thread).
+#define CLASSIFY_JOB_ENTRY_COUNT 8192
+
+// What is done with an entry (see ClassifyJob::entryInstructions), an
+// instruction index otherwise.
+#define ENTRY_SKIPPED -1
+#define ENTRY_UNMATCHED -2
+// Its content is sniffed (see matchJobProc).
+#define ENTRY_TO_SNIFF -3
+
+struct UnmatchedEntry
+{
+	int entryIndex;
+	char extension[64];
+};
+
+/*
+  NOTE
+
+  Entries [first, last[ of entryList, classified by one thread, in two
+  passes (each job of a pass on its own thread):
+
+  - matchJobProc gets the instruction of each entry from its
+    extension. Entries whose extension has none, or may be misleading
+    (see magic.cpp), are left to sniff.
+  - Those are then sniffed all at once (see magic.cpp), by the
+    calling thread (sniffFiles has its own threads).
+  - bucketJobProc adds each entry to the arguments of its
+    instruction.
+*/
+struct ClassifyJob
+{
+	Context *context;
+	EntryList *entryList;
+	int first;
+	int last;
+
+	// One per entry of entryList (shared, each job writes its range).
+	i32 *entryInstructions;
+
+	// Entries to sniff, in order.
+	int *sniffEntries;
+	int sniffCount;
+	int sniffCapacity;
+
+	// One per instruction. The first job adds to the ones of context
+	// (its entries come first), the others to their own, appended in
+	// order once all are done: arguments keep the order of entries.
+	ArgumentList *argumentLists;
+
+	// Reported in order too, once all are done.
+	UnmatchedEntry *unmatchedEntries;
+	int unmatchedCount;
+	int unmatchedCapacity;
+
+	int entryCount;
+
+	pthread_t handle;
+	b32 isStarted;
+};
+
+typedef void *ClassifyJobProc(void *parameter);
+
+// Run proc on each job, the first one (and those of threads which
+// could not start) on the calling thread.
+static void runClassifyJobs(ClassifyJob *jobs, int jobCount, ClassifyJobProc *proc)
+{
+	for (int i = 1; i < jobCount; ++i)
+	{
+		jobs[i].isStarted = (pthread_create(&jobs[i].handle, NULL, proc, jobs + i) == 0);
 	}
-	
-	Instruction allInstructions[42];
-	int instructionCount = makeInstructionsFromConfig(configFile, allInstructions,
-													  (i32) ARRAY_SIZE(allInstructions));
-	Instruction *defaultInstruction = allInstructions;
 
-	// Default instruction is the only one without any associated
-	// extension (just after reading the config file).
-	for (int index = 0; index < instructionCount; ++index)
+	proc(jobs);
+
+	for (int i = 1; i < jobCount; ++i)
 	{
-		if (!(defaultInstruction->extensionCount))
+		if (jobs[i].isStarted)
 		{
-			break;
+			pthread_join(jobs[i].handle, NULL);
+		}
+		else
+		{
+			proc(jobs + i);
 		}
-
-		++defaultInstruction;
 	}
-		
-	if ((defaultInstruction - allInstructions) >= instructionCount)
+}
+
+static i32 getEntryInstructionIndex(Context *context, char *extension)
+{
+	b32 toSkip;
+	Instruction *instruction = getEntryInstruction(context, extension, strlen(extension), &toSkip);
+
+	if (toSkip)
 	{
-		defaultInstruction = NULL;
+		return ENTRY_SKIPPED;
 	}
 
+	return instruction
+		? (i32) (instruction - context->instructionTable->instructions)
+		: ENTRY_UNMATCHED;
+}
+
+static inline b32 isSniffing(Context *context)
+{
+	return ((context->magicTable->signatureCount ||
+			 context->magicTable->textExtension) &&
+			!(context->optionFlags & OptionFlag_No_Sniff));
+}
+
+// NOTE: Only reads what is shared (config, index, trie), each job has
+//       its own entries.
+static void *matchJobProc(void *parameter)
+{
+	ClassifyJob *job = (ClassifyJob *) parameter;
+	Context *context = job->context;
+	EntryList *entryList = job->entryList;
+	b32 canSniff = isSniffing(context);
+
 	// Find corresponding command (based on entry's extension).
-	for (int i = 0; i < entryCount; ++i)
+	for (int i = job->first; i < job->last; ++i)
 	{
-		char *entry = allEntries[i];
-		char extension[64];
-		
-		// No directory if --recursive is set.
-		if (optionFlags & OptionFlag_Recursive)
+		if (entryList->entries[i].isRemoved)
 		{
-			getFileExtension(entry, extension);
+			job->entryInstructions[i] = ENTRY_SKIPPED;
+			continue;
 		}
-		else
-		{
-			getExtension(entry, extension);
-		}		
-		
-		size_t extensionLength = strlen(extension);
 
-		b32 toSkip = false;
+		++job->entryCount;
 		
-		if (onlyArrayCount)
+		char extension[64];
+		getEntryExtension(context, entryList, i, extension);
+
+		// Files whose extension has no instruction (or which have
+		// none) are sniffed, they may be of a known format. So are
+		// files of a known format, which may be another one.
+		b32 toSniff = false;
+
+		if (canSniff &&
+			(strcmp(extension, "/") != 0))
 		{
-			toSkip = true;
+			Instruction *instruction = getInstructionByExtension(&context->instructionIndex,
+																 extension, strlen(extension));
+
+			toSniff = (!instruction || isInstructionSniffed(context->magicTable, instruction));
+		}
 
-			// Extension explicitly asked.
-			for (int index = 0; index < onlyArrayCount; ++index)
+		if (toSniff)
+		{
+			if (job->sniffCount == job->sniffCapacity)
 			{
-				if ((extensionLength == onlyArrayLength[index]) &&
-					(strncmp(extension, onlyArray[index], extensionLength) == 0))
-				{
-					toSkip = false;
-				}
+				job->sniffCapacity = job->sniffCapacity ? 2 * job->sniffCapacity : 256;
+				job->sniffEntries = (int *) realloc(job->sniffEntries, job->sniffCapacity * sizeof(int));
+				ASSERT(job->sniffEntries);
 			}
+
+			job->sniffEntries[job->sniffCount++] = i;
+			job->entryInstructions[i] = ENTRY_TO_SNIFF;
+			continue;
 		}
 
-		Instruction *instruction = getInstructionByExtension(extension, extensionLength,
-															 allInstructions, instructionCount);
+		job->entryInstructions[i] = getEntryInstructionIndex(context, extension);
+	}
+
+	return NULL;
+}
+
+static void *bucketJobProc(void *parameter)
+{
+	ClassifyJob *job = (ClassifyJob *) parameter;
+	Context *context = job->context;
+	EntryList *entryList = job->entryList;
 
-		if (instruction)
+	for (int i = job->first; i < job->last; ++i)
+	{
+		i32 instructionIndex = job->entryInstructions[i];
+
+		if (instructionIndex >= 0)
+		{
+			addArgument(job->argumentLists + instructionIndex, getEntryPath(entryList, i));
+		}
+		else if (instructionIndex == ENTRY_UNMATCHED)
 		{
-			if (toSkip)
+			if (job->unmatchedCount == job->unmatchedCapacity)
 			{
-				for (int index = 0; index < onlyArrayCount; ++index)
-				{
-					if (instructionHasTag(instruction, onlyArray[index], onlyArrayLength[index]))
-					{
-						toSkip = false;
-					}
-				}
+				job->unmatchedCapacity = job->unmatchedCapacity ? 2 * job->unmatchedCapacity : 16;
+				job->unmatchedEntries = (UnmatchedEntry *) realloc(job->unmatchedEntries,
+																   job->unmatchedCapacity * sizeof(UnmatchedEntry));
+				ASSERT(job->unmatchedEntries);
 			}
 
-			if (toSkip)
-			{
-				continue;
-			}
-			
-			ASSERT(instruction->argumentCount < (i32) ARRAY_SIZE(instruction->arguments));
-					
-			instruction->arguments[instruction->argumentCount++] = entry;
+			UnmatchedEntry *unmatched = job->unmatchedEntries + job->unmatchedCount++;
+
+			unmatched->entryIndex = i;
+			getEntryExtension(context, entryList, i, unmatched->extension);
 		}
-		else if (defaultInstruction)
-		{
-			ASSERT(defaultInstruction->argumentCount < (i32) ARRAY_SIZE(defaultInstruction->arguments));
+	}
 
-			if (toSkip)
-			{
-				for (int index = 0; index < onlyArrayCount; ++index)
-				{
-					if (instructionHasTag(defaultInstruction, onlyArray[index], onlyArrayLength[index]))
-					{
-						toSkip = false;
-					}
-				}
-			}
+	return NULL;
+}
 
-			if (toSkip)
-			{
-				continue;
-			}
-				
-			defaultInstruction->arguments[defaultInstruction->argumentCount++] = entry;
-			strcpy(defaultInstruction->extensions[defaultInstruction->extensionCount], extension);
-			defaultInstruction->extensionsLength[defaultInstruction->extensionCount++] = extensionLength;
+// Sniff the entries the jobs left to sniff, and set their instruction
+// (from the extension found, or their own if none is).
+static void sniffEntries(Context *context, EntryList *entryList, ClassifyJob *jobs, int jobCount,
+						 i32 *entryInstructions)
+{
+	int sniffCount = 0;
+
+	for (int i = 0; i < jobCount; ++i)
+	{
+		sniffCount += jobs[i].sniffCount;
+	}
+
+	if (!sniffCount)
+	{
+		return;
+	}
+
+	int *entryIndices = (int *) malloc(sniffCount * sizeof(int));
+	char **paths = (char **) malloc(sniffCount * sizeof(char *));
+	char **extensions = (char **) malloc(sniffCount * sizeof(char *));
+	ASSERT(entryIndices && paths && extensions);
+
+	int index = 0;
+
+	for (int i = 0; i < jobCount; ++i)
+	{
+		for (int sniffIndex = 0; sniffIndex < jobs[i].sniffCount; ++sniffIndex)
+		{
+			entryIndices[index] = jobs[i].sniffEntries[sniffIndex];
+			paths[index] = getEntryPath(entryList, entryIndices[index]);
+			++index;
 		}
-		else if (!toSkip)
+	}
+
+	PROFILE_BEGIN(Sniff);
+	sniffFiles(context->magicTable, paths, sniffCount, context->jobCount, context->ioDepth, extensions);
+	PROFILE_END(Sniff);
+
+	for (int i = 0; i < sniffCount; ++i)
+	{
+		char extension[64];
+		getEntryExtension(context, entryList, entryIndices[i], extension);
+
+		// NOTE: A sniffed extension always has an instruction. Text
+		//       only replaces an extension which has none.
+		if (extensions[i] &&
+			((extensions[i] != context->magicTable->textExtension) ||
+			 !getInstructionByExtension(&context->instructionIndex, extension, strlen(extension))))
 		{
-			// TODO?: Keep separate error message or group by extension?
-			char buffer[255];
-			sprintf(buffer, "%s: %s: no command specified for extension '%s'.\n",
-					ME, entry, extension);
-			fprintf(stderr, buffer);
+			strcpy(extension, extensions[i]);
 		}
+
+		entryInstructions[entryIndices[i]] = getEntryInstructionIndex(context, extension);
 	}
 
-	// Execute each command with associated entries.
-	for (int i = 0; i < instructionCount; ++i)
+	free(entryIndices);
+	free(paths);
+	free(extensions);
+}
+
+// Add each entry of entryList to the arguments of its instruction,
+// using up to context->jobCount threads.
+static void classifyEntries(Context *context, EntryList *entryList)
+{
+	// Types are needed to get extensions (directories have none),
+	// when they matter.
+	if (!(context->optionFlags & OptionFlag_Recursive))
+	{
+		statNeededEntries(context, entryList);
+	}
+
+	u32 instructionCount = context->instructionTable->instructionCount;
+	int jobCount = MIN(context->jobCount, entryList->count / CLASSIFY_JOB_ENTRY_COUNT + 1);
+	ClassifyJob *jobs = (ClassifyJob *) calloc(jobCount, sizeof(ClassifyJob));
+	i32 *entryInstructions = (i32 *) malloc((entryList->count + 1) * sizeof(i32));
+	ASSERT(jobs && entryInstructions);
+
+	int first = 0;
+
+	for (int i = 0; i < jobCount; ++i)
+	{
+		int last = (i32) (((i64) entryList->count * (i + 1)) / jobCount);
+
+		jobs[i].context = context;
+		jobs[i].entryList = entryList;
+		jobs[i].first = first;
+		jobs[i].last = last;
+		jobs[i].entryInstructions = entryInstructions;
+		jobs[i].argumentLists = i
+			? (ArgumentList *) calloc(instructionCount + 1, sizeof(ArgumentList))
+			: context->argumentLists;
+		ASSERT(jobs[i].argumentLists);
+
+		first = last;
+	}
+
+	runClassifyJobs(jobs, jobCount, matchJobProc);
+
+	sniffEntries(context, entryList, jobs, jobCount, entryInstructions);
+
+	runClassifyJobs(jobs, jobCount, bucketJobProc);
+
+	// Merge, in the order of entries.
+	for (int i = 0; i < jobCount; ++i)
 	{
-		Instruction instruction = allInstructions[i];
+		ClassifyJob *job = jobs + i;
 
-		if (!instruction.argumentCount)
+		PROFILE_COUNT_ENTRIES(job->entryCount);
+
+		for (int unmatchedIndex = 0; unmatchedIndex < job->unmatchedCount; ++unmatchedIndex)
 		{
-			continue;
+			UnmatchedEntry *unmatched = job->unmatchedEntries + unmatchedIndex;
+
+			// TODO?: Keep separate error message or group by extension?
+			// NOTE: Paths have no length limit, and may contain '%'.
+			fprintf(stderr, "%s: %s: no command specified for extension '%s'.\n",
+					ME, getEntryPath(entryList, unmatched->entryIndex), unmatched->extension);
 		}
 
-		// TODO: Move this part to config_file_parser (because
-		//       shell functions' path will be infered there).
-		char *whichArgs[] =
+		if (i)
+		{
+			for (u32 index = 0; index < instructionCount; ++index)
 			{
-				"which",
-				instruction.command,
-				NULL
-			};
-		
-		int statusCode = 0;
-		int status = childExec("/usr/bin/which", whichArgs, &statusCode,
-							   instruction.commandPath, ARRAY_SIZE(instruction.commandPath));
+				ArgumentList *list = job->argumentLists + index;
 
-		if (status != 0)
-		{		
-			continue;
+				if (list->count)
+				{
+					addArguments(context->argumentLists + index, list->arguments, list->count);
+					free(list->arguments);
+				}
+			}
+
+			free(job->argumentLists);
 		}
 
-		// NOTE: If which did not find the command, we assume it's a
-		//       shell function defined in ~/.bashrc.
-		char *path = (statusCode == 0) ? instruction.commandPath : (char *) "~/.bashrc";
-		
-		if (optionFlags & OptionFlag_Which)
+		free(job->sniffEntries);
+		free(job->unmatchedEntries);
+	}
+
+	free(jobs);
+	free(entryInstructions);
+}
+
+// Number of bytes the arguments of a single execv can take (argv and
+// environment share ARG_MAX).
+static size_t getArgumentBudget()
+{
+	static size_t budget = 0;
+
+	if (!budget)
+	{
+		long argMax = sysconf(_SC_ARG_MAX);
+
+		if (argMax <= 0)
 		{
-			printf("%s (%s)", instruction.command, path);
-			PRINT_N_ARRAY("\n\t%s", "", instruction.arguments, instruction.argumentCount);
-			printf("\n\n");
+			argMax = _POSIX_ARG_MAX;
 		}
-		// It's a script.
-		else if (statusCode == 0)
+
+		size_t environmentSize = sizeof(char *);
+
+		for (char **variable = environ; *variable; ++variable)
 		{
-			// + 2: command name + NULL. 
-			char *commandArgs[ARRAY_SIZE(((Instruction *) 0)->arguments) + 2] = {};
+			environmentSize += strlen(*variable) + 1 + sizeof(char *);
+		}
+
+		// Same headroom as xargs, and argv's NULL.
+		size_t reserved = environmentSize + 2048 + sizeof(char *);
+
+		budget = ((size_t) argMax > reserved) ? argMax - reserved : 1;
+	}
 
-			commandArgs[0] = instruction.command;
-			memcpy(commandArgs + 1, instruction.arguments, instruction.argumentCount * sizeof(char *));
+	return budget;
+}
+
+// Wait until at most maxRunningCount batches are running.
+static void waitForProcesses(Context *context, int maxRunningCount)
+{
+	PROFILE_BEGIN(Wait);
 
-			childExec(path, commandArgs,
-					  NULL, NULL, 0, NULL, 0, true);
+	while (context->runningProcessCount + context->bashPool.busyCount > maxRunningCount)
+	{
+		// NOTE: Workers are not waited for with wait(2), functions
+		//       are waited for first.
+		if (waitForBashWorker(&context->bashPool))
+		{
+			continue;
 		}
-		// It's a function.
-		else
+
+		if ((wait(NULL) == -1) && (errno != EINTR))
 		{
-			// TODO: Actually compute max length!
-			// NOTE: To be correctly interpreted by bash, it must be:
-			//       ". SOURCE_FILE && CMD ARGS" as one string.
-			char bashCommand[4096] = {". "};
-			char *current = bashCommand + 2;
-
-			// Why strcpy doesn't return where it stopped writing
-			// instead of returning the original buffer is beyond
-			// me...
-			current = strcpy(current, path) + strlen(path);
-			*current++ = ' '; *current++ = '&'; *current++ = '&'; *current++ = ' ';
-			
-			current = strcpy(current, instruction.command) + instruction.commandLength;
-			*current++ = ' ';
-			
-			for (int index = 0; index < instruction.argumentCount; ++index)
-			{
-				char *argument = instruction.arguments[index];
-				
-				ASSERT(((current + strlen(argument) + 1) - bashCommand) < (i32) ARRAY_SIZE(bashCommand));
-				
-				current = strcpy(current, argument) + strlen(argument);
-				*current++ = ' ';
-			}
+			context->runningProcessCount = 0;
+			break;
+		}
 
-			*(--current) = '\0';
-			
-			char *bashArgs[ARRAY_SIZE(((Instruction *) 0)->arguments) + 3] =
-				{
-					"bash",
-					"-c",
-					bashCommand,
-					NULL,
-				};
-			
-			childExec("/bin/bash", bashArgs,
-					  NULL, NULL, 0, NULL, 0, false);
+		--context->runningProcessCount;
+	}
+
+	PROFILE_END(Wait);
+}
+
+static void startProcess(Context *context, char *commandPath, char *args[], b32 inBackground)
+{
+	if (context->maxProcessCount)
+	{
+		waitForProcesses(context, context->maxProcessCount - 1);
+
+		pid_t pid;
+
+		PROFILE_BEGIN(Launch);
+
+		if (childExec(commandPath, args, NULL, NULL, 0, NULL, 0, true, &pid) == 0)
+		{
+			++context->runningProcessCount;
 		}
+
+		PROFILE_END(Launch);
 	}
-	
-	return 0;
+	else
+	{
+		PROFILE_BEGIN(Launch);
+		childExec(commandPath, args, NULL, NULL, 0, NULL, 0, inBackground);
+		PROFILE_END(Launch);
+	}
+}
+
+static void launchProgram(Context *context, char *command, char *path,
+						  char **arguments, int argumentCount)
+{
+	// + 2: command name + NULL.
+	char **commandArgs = (char **) malloc((argumentCount + 2) * sizeof(char *));
+	ASSERT(commandArgs);
+
+	commandArgs[0] = command;
+	memcpy(commandArgs + 1, arguments, argumentCount * sizeof(char *));
+	commandArgs[argumentCount + 1] = NULL;
+
+	startProcess(context, path, commandArgs, true);
+
+	free(commandArgs);
+}
+
+// Run a function in a bash which sourced ~/.bashrc (see
+// bash_worker.cpp). Like programs, only waited for when -P is not
+// given.
+static void launchFunction(Context *context, char *command,
+						   char **arguments, int argumentCount)
+{
+	if (context->maxProcessCount)
+	{
+		waitForProcesses(context, context->maxProcessCount - 1);
+	}
+
+	PROFILE_BEGIN(Launch);
+	b32 isRunning = runInBashWorker(&context->bashPool, command, arguments, argumentCount);
+	PROFILE_END(Launch);
+
+	if (isRunning &&
+		!context->maxProcessCount)
+	{
+		PROFILE_BEGIN(Wait);
+		waitForBashWorker(&context->bashPool);
+		PROFILE_END(Wait);
+	}
+}
+
+// Execute each instruction with its arguments (or show them if
+// --which), then clear them so instructions can be reused for
+// another batch of entries.
+// Arguments are split in batches that fit in ARG_MAX (like xargs).
+static void executeInstructions(Context *context)
+{
+	InstructionTable *table = context->instructionTable;
+
+	// Execute each command with associated entries.
+	for (u32 i = 0; i < table->instructionCount; ++i)
+	{
+		Instruction *instruction = table->instructions + i;
+		ArgumentList *list = context->argumentLists + i;
+
+		if (!list->count)
+		{
+			continue;
+		}
+
+		char command[255];
+		char commandPath[255];
+		b32 isCached = false;
+
+		if (!copyString(table, instruction->command, command, ARRAY_SIZE(command)))
+		{
+			fprintf(stderr, "%s: skipping command %.*s..., longer than %d bytes.\n",
+					ME, 32, getString(table, instruction->command), (int) ARRAY_SIZE(command) - 1);
+
+			list->count = 0;
+			continue;
+		}
+
+		PROFILE_BEGIN(Resolve);
+		b32 isInPath = resolveCommandPath(command, commandPath, ARRAY_SIZE(commandPath), &isCached);
+		PROFILE_END(Resolve);
+
+		// NOTE: If the command is not in PATH, we assume it's a
+		//       shell function defined in ~/.bashrc.
+		char *path = isInPath ? commandPath : (char *) "~/.bashrc";
+		
+		if (context->optionFlags & OptionFlag_Which)
+		{
+			printf("%s (%s)%s", command, path, isCached ? " [cached]" : "");
+			PRINT_N_ARRAY("\n\t%s", "", list->arguments, list->count);
+			printf("\n\n");
+		}
+		else
+		{
+			// NOTE: Functions get the same batches, they may give
+			//       their arguments to a program.
+			size_t budget = getArgumentBudget();
+			size_t fixedSize = instruction->command.length + 1 + sizeof(char *);
+
+			budget = (budget > fixedSize) ? budget - fixedSize : 0;
+			
+			int first = 0;
+
+			while (first < list->count)
+			{
+				size_t size = 0;
+				int last = first;
+
+				// NOTE: An argument too big on its own still gets its
+				//       own batch (execv will report the error).
+				while (last < list->count)
+				{
+					size_t argumentSize = strlen(list->arguments[last]) + 1 + sizeof(char *);
+
+					if ((last > first) && (size + argumentSize > budget))
+					{
+						break;
+					}
+
+					size += argumentSize;
+					++last;
+				}
+
+				// It's a script.
+				if (isInPath)
+				{
+					launchProgram(context, command, path,
+								  list->arguments + first, last - first);
+				}
+				// It's a function.
+				else
+				{
+					launchFunction(context, command,
+								   list->arguments + first, last - first);
+				}
+
+				first = last;
+			}
+		}
+
+		list->count = 0;
+	}
+}
+
+static void processEntries(Context *context, EntryList *entryList)
+{
+	PROFILE_BEGIN(Walk);
+	addSubDirectories(context, entryList);
+	PROFILE_END(Walk);
+
+	PROFILE_BEGIN(Classify);
+	classifyEntries(context, entryList);
+	PROFILE_END(Classify);
+
+	executeInstructions(context);
+
+	clearEntryList(entryList);
+}
+
+static void addEntryFromArgument(Context *context, EntryList *entryList, char *argument, size_t length)
+{
+	EntryType type = EntryType_Unknown;
+
+	// NOTE: Only a directory can be followed by '/' (no need to stat
+	//       it).
+	if ((length > 1) &&
+		(argument[length - 1] == '/'))
+	{
+		--length;
+		type = EntryType_Directory;
+		++counters.statAvoidedCount;
+	}
+
+	if (length > 0)
+	{
+		addEntry(entryList, argument, length, type);
+	}
+}
+
+#define STDIN_BLOCK_SIZE (64 * 1024)
+
+#define STDIN_BATCH_ENTRY_COUNT 4096
+
+// Read entries from stdin, separated by NUL (find -print0, fd -0, ...)
+// or by newlines if the first block read does not contain any NUL.
+// Entries are processed by batch as they are read, so memory does not
+// depend on the total number of entries.
+static void processEntriesFromStdin(Context *context, EntryList *entryList)
+{
+	char *block = (char *) malloc(STDIN_BLOCK_SIZE);
+	size_t blockSize = 0;
+
+	char delimiter = '\0';
+	b32 isDelimiterKnown = false;
+
+	// Set when an entry does not fit in a block: the rest of it is
+	// dropped.
+	b32 isSkippingEntry = false;
+
+	ASSERT(block);
+
+	for (;;)
+	{
+		ssize_t bytesRead = read(STDIN_FILENO, block + blockSize, STDIN_BLOCK_SIZE - blockSize);
+
+		if (bytesRead < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			char buffer[255];
+			sprintf(buffer, "%s: could not read from stdin", ME);
+			perror(buffer);
+
+			break;
+		}
+
+		if (!isDelimiterKnown && (bytesRead > 0))
+		{
+			delimiter = memchr(block + blockSize, '\0', bytesRead) ? '\0' : '\n';
+			isDelimiterKnown = true;
+		}
+
+		b32 isEndOfFile = (bytesRead == 0);
+
+		char *at = block;
+		char *end = block + blockSize + bytesRead;
+		char *next;
+
+		while ((next = (char *) memchr(at, delimiter, end - at)) != NULL)
+		{
+			if (!isSkippingEntry)
+			{
+				addEntryFromArgument(context, entryList, at, next - at);
+
+				if (entryList->count >= STDIN_BATCH_ENTRY_COUNT)
+				{
+					processEntries(context, entryList);
+				}
+			}
+
+			isSkippingEntry = false;
+			at = next + 1;
+		}
+
+		if (isEndOfFile)
+		{
+			if ((at < end) && !isSkippingEntry)
+			{
+				addEntryFromArgument(context, entryList, at, end - at);
+			}
+
+			break;
+		}
+
+		// Keep the beginning of the last entry for the next block.
+		blockSize = end - at;
+
+		if (blockSize == STDIN_BLOCK_SIZE)
+		{
+			fprintf(stderr, "%s: skipping entry from stdin, longer than %d bytes.\n",
+					ME, STDIN_BLOCK_SIZE);
+
+			isSkippingEntry = true;
+			blockSize = 0;
+		}
+		else
+		{
+			memmove(block, at, blockSize);
+		}
+	}
+
+	free(block);
+
+	if (entryList->count)
+	{
+		processEntries(context, entryList);
+	}
+}
+
+// Config file and everything derived from it. Loaded once per run,
+// or once for all requests in daemon mode.
+struct LoadedConfig
+{
+	char configFile[255];
+	struct stat configStat;
+	b32 hasConfigStat;
+	b32 isLoaded;
+
+	InstructionTable instructionTable;
+	Instruction *defaultInstruction;
+	InstructionIndex instructionIndex;
+	ExtensionTrie extensionTrie;
+	MagicTable magicTable;
+};
+
+static LoadedConfig loadedConfig;
+
+// Return 0, or the exit code on error.
+static int getConfigFile(char *configFile)
+{
+#if XOPEN_BAKED
+	// Only a name, the config is in the binary (see loadConfig).
+	sprintf(configFile, "%s (baked)", ME);
+#else
+	char *homeDir = NULL;
+	
+	if ((homeDir = getenv("XDG_CONFIG_HOME")) != NULL)
+	{
+		sprintf(configFile, "%s/%s.conf", homeDir, ME);
+	}
+	else if (((homeDir = getenv("HOME")) != NULL) ||
+			 ((homeDir = getpwuid(getuid())->pw_dir) != NULL))
+	{
+		sprintf(configFile, "%s/.config/%s.conf", homeDir, ME);
+	}
+	else
+	{
+		char buffer[255];
+		sprintf(buffer, "%s: could not create config file: no home directory found.\n", ME);
+		fprintf(stderr, buffer);
+ 
+		return -1;
+	}
+#endif
+
+	return 0;
+}
+
+// Return 0, or the exit code on error (the config loaded before, if
+// any, is kept).
+static int loadConfig(LoadedConfig *config, char *configFile, b32 rebuildCache)
+{
+	PROFILE_BEGIN(Config_Load);
+
+	InstructionTable *table = &config->instructionTable;
+
+#if XOPEN_BAKED
+	// NOTE: The config is in the binary (make baked): there is nothing
+	//       to open, parse or index, nor to load again.
+	if (config->isLoaded)
+	{
+		PROFILE_END(Config_Load);
+		return 0;
+	}
+
+	strcpy(config->configFile, configFile);
+	loadBakedConfig(table, &config->instructionIndex);
+
+	int instructionCount = (int) table->instructionCount;
+#else
+	// NOTE: The only time the config is opened (it's created if it does
+	//       not exist): its stat is the key of the cache, and it's only
+	//       mapped if the cache can't be used.
+	int configFd = open(configFile, O_RDONLY | O_CREAT | O_CLOEXEC, 0666);
+
+	if (configFd == -1)
+	{
+		char buffer[255];
+		sprintf(buffer, "%s: could not read config file '%.200s'.\n", ME, configFile);
+		fprintf(stderr, buffer);
+
+		PROFILE_END(Config_Load);
+		return -2;
+	}
+
+	if (config->isLoaded)
+	{
+		freeInstructionIndex(&config->instructionIndex);
+		freeExtensionTrie(&config->extensionTrie);
+		freeMagicTable(&config->magicTable);
+		freeInstructionTable(&config->instructionTable);
+	}
+
+	strcpy(config->configFile, configFile);
+
+	int instructionCount = -1;
+
+	// The compiled cache lives next to the config file and is only
+	// used if the config did not change since it was written.
+	char cacheFile[255 + 6];
+	sprintf(cacheFile, "%s.cache", configFile);
+
+	config->hasConfigStat = (fstat(configFd, &config->configStat) == 0);
+
+	if (config->hasConfigStat &&
+		!rebuildCache)
+	{
+		instructionCount = loadInstructionsFromCache(cacheFile, &config->configStat, table);
+	}
+
+	if (instructionCount < 0)
+	{
+		PROFILE_BEGIN(Config_Parse);
+		instructionCount = makeInstructionsFromConfig(configFile, configFd,
+													  config->hasConfigStat ? config->configStat.st_size : 0,
+													  table);
+		PROFILE_END(Config_Parse);
+
+		if (config->hasConfigStat)
+		{
+			saveInstructionsToCache(cacheFile, &config->configStat, table);
+		}
+	}
+
+	close(configFd);
+#endif
+
+	// Default instruction is the first one without any associated
+	// extension.
+	config->defaultInstruction = NULL;
+
+	for (int index = 0; index < instructionCount; ++index)
+	{
+		if (!table->instructions[index].extensionCount)
+		{
+			config->defaultInstruction = table->instructions + index;
+			break;
+		}
+	}
+
+	config->isLoaded = true;
+
+#if !XOPEN_BAKED
+	buildInstructionIndex(&config->instructionIndex, table);
+#endif
+	buildExtensionTrie(&config->extensionTrie, table, &config->instructionIndex);
+	buildMagicTable(&config->magicTable, &config->instructionIndex);
+
+	PROFILE_END(Config_Load);
+
+	return 0;
+}
+
+// Handle one call of xopen (in-process, or in a child of the daemon).
+static int xopenMain(int argc, char* argv[])
+{
+	PROFILE_RESET();
+	PROFILE_BEGIN(Config_Setup);
+
+	char configFile[255];
+	int error = getConfigFile(configFile);
+
+	if (error)
+	{
+		return error;
+	}
+
+	// In a child of the daemon, the config is already loaded (unless
+	// the client uses another one).
+	b32 isConfigLoaded = (loadedConfig.isLoaded &&
+						  (strcmp(loadedConfig.configFile, configFile) == 0));
+
+	PROFILE_END(Config_Setup);
+	
+	int helpFlag = 0,
+		versionFlag = 0,
+		rebuildCacheFlag = 0,
+		statsFlag = 0,
+		noSniffFlag = 0,
+		// Handled by main.
+		daemonFlag = 0,
+		noDaemonFlag = 0;
+	
+	char onlyArray[10][64];
+	size_t onlyArrayLength[10];
+	int onlyArrayCount = 0;
+	
+	i32 optionFlags = OptionFlag_None;
+	int jobCount = 1;
+	u32 ioDepth = DEFAULT_IO_DEPTH;
+	int maxProcessCount = 0;
+	b32 isProfiling = false;
+	// NULL for stderr.
+	char *profileFile = NULL;
+
+	// NOTE: I will probably have to parse the command line myself, as
+	//       getopt does not support multiple arguments for given option.
+	static struct option longOptions[] =
+		{
+			{"help"							, no_argument, &helpFlag, 1},
+			{"version"						, no_argument, &versionFlag, 1},
+			{"which"						, no_argument, 0, 'w'},
+			{"execute"						, no_argument, 0, 'e'},
+			{"recursive"					, no_argument, 0, 'r'},
+			{"recursive-keep-directories"	, no_argument, 0, 'R'},
+			{"directory"					, no_argument, 0, 'd'},
+			{"only"							, required_argument, 0, 'o'},
+			{"jobs"							, required_argument, 0, 'j'},
+			{"from-stdin"					, no_argument, 0, '0'},
+			{"max-procs"					, required_argument, 0, 'P'},
+			{"io-depth"						, required_argument, 0, 'I'},
+			{"no-sniff"						, no_argument, &noSniffFlag, 1},
+			{"rebuild-cache"				, no_argument, &rebuildCacheFlag, 1},
+			{"stats"						, no_argument, &statsFlag, 1},
+#if XOPEN_PROFILE
+			{"profile"						, optional_argument, 0, 'p'},
+#endif
+			{"daemon"						, no_argument, &daemonFlag, 1},
+			{"no-daemon"					, no_argument, &noDaemonFlag, 1},
+			{0								, 0, 0, 0}
+		};
+			
+	int c;
+	
+	for(;;)
+	{
+		int optionIndex = 0;
+		
+		// I'll add an 'i' soon.
+		// Promised.
+		c = getopt_long(argc, argv, "werRdo:j:0P:", longOptions, &optionIndex);
+
+		if (c == -1)
+		{
+			break;
+		}
+			
+		switch (c)
+		{
+			case 0:
+			{
+				if (longOptions[optionIndex].flag != 0)
+				{
+					break;
+				}
+				// printf("option %s\n", longOptions[optionIndex].name);
+				// return 0;
+			}
+			case 'w':
+			{
+				optionFlags |= OptionFlag_Which;
+				break;
+			}
+			case 'e':
+			{
+				optionFlags &= ~OptionFlag_Which;
+				break;
+			}
+			case 'r':
+			{
+				optionFlags &= ~OptionFlag_Recursive_Keep_Directories;
+				optionFlags |= OptionFlag_Recursive;
+				break;
+			}
+			case 'R':
+			{
+				optionFlags &= ~OptionFlag_Recursive;
+				optionFlags |= OptionFlag_Recursive_Keep_Directories;
+				break;
+			}
+			case 'd':
+			{
+				optionFlags &= ~OptionFlag_Recursive;
+				break;
+			}
+			case 'o':
+			{
+				optionFlags |= OptionFlag_Only;
+				size_t length = strlen(optarg);
+				
+				if (length >= ARRAY_SIZE(onlyArray[0]))
+				{
+					fprintf(stderr, "%s: -o/--only: %s is too long (> %d characters).\n",
+							ME, optarg, (i32) ARRAY_SIZE(onlyArray[0]) - 1);
+
+					return -1;
+				}
+				
+				onlyArrayLength[onlyArrayCount] = length;
+				strcpy(onlyArray[onlyArrayCount++], optarg);
+				
+				break;
+			}
+			case '0':
+			{
+				optionFlags |= OptionFlag_From_Stdin;
+				break;
+			}
+			case 'P':
+			{
+				char *end;
+				long count = strtol(optarg, &end, 10);
+
+				if ((*end != '\0') || (count < 1) || (count > 1024))
+				{
+					char buffer[255];
+
+					sprintf(buffer, "%s: -P/--max-procs: %.32s is not a valid number of processes (1-1024).\n",
+							ME, optarg);
+					fprintf(stderr, buffer);
+
+					return -1;
+				}
+
+				maxProcessCount = (i32) count;
+				
+				break;
+			}
+			case 'j':
+			{
+				char *end;
+				long count = strtol(optarg, &end, 10);
+
+				if ((*end != '\0') || (count < 1) || (count > 1024))
+				{
+					char buffer[255];
+
+					sprintf(buffer, "%s: -j/--jobs: %.32s is not a valid number of jobs (1-1024).\n",
+							ME, optarg);
+					fprintf(stderr, buffer);
+
+					return -1;
+				}
+
+				jobCount = (i32) count;
+				
+				break;
+			}
+			// Only --profile.
+			case 'p':
+			{
+				isProfiling = true;
+				profileFile = optarg;
+				
+				break;
+			}
+			// Only --io-depth.
+			case 'I':
+			{
+				char *end;
+				long depth = strtol(optarg, &end, 10);
+
+				if ((*end != '\0') || (depth < 0) || (depth > 4096))
+				{
+					char buffer[255];
+
+					sprintf(buffer, "%s: --io-depth: %.32s is not a valid queue depth (0-4096).\n",
+							ME, optarg);
+					fprintf(stderr, buffer);
+
+					return -1;
+				}
+
+				ioDepth = (u32) depth;
+				
+				break;
+			}
+			default:
+			{
+				return -1;
+				break;
+			}
+		}
+	}
+
+	if (helpFlag)
+	{
+		printf("%s", usage);
+		return 0;
+	}
+
+	if (versionFlag)
+	{
+		printf("%s", version);
+		return 0;
+	}
+
+	if (rebuildCacheFlag)
+	{
+		optionFlags |= OptionFlag_Rebuild_Cache;
+	}
+
+	if (statsFlag)
+	{
+		optionFlags |= OptionFlag_Stats;
+	}
+
+	if (noSniffFlag)
+	{
+		optionFlags |= OptionFlag_No_Sniff;
+	}
+
+	int argumentEntryCount = argc - optind;
+
+	if ((argumentEntryCount <= 0) &&
+		!(optionFlags & OptionFlag_From_Stdin))
+	{
+		char buffer[255];
+		sprintf(buffer, "%s: no file given.\n", ME);
+		fprintf(stderr, buffer);
+
+		return 1;
+	}
+
+	if ((!isConfigLoaded ||
+		 (optionFlags & OptionFlag_Rebuild_Cache)) &&
+		((error = loadConfig(&loadedConfig, configFile, optionFlags & OptionFlag_Rebuild_Cache)) != 0))
+	{
+		return error;
+	}
+
+	Context context = {};
+	context.optionFlags = optionFlags;
+	context.jobCount = jobCount;
+	context.ioDepth = ioDepth;
+	context.maxProcessCount = maxProcessCount;
+	context.onlyArray = onlyArray;
+	context.onlyArrayLength = onlyArrayLength;
+	context.onlyArrayCount = onlyArrayCount;
+	context.instructionTable = &loadedConfig.instructionTable;
+	context.defaultInstruction = loadedConfig.defaultInstruction;
+	context.instructionIndex = loadedConfig.instructionIndex;
+	context.extensionTrie = &loadedConfig.extensionTrie;
+	context.magicTable = &loadedConfig.magicTable;
+	context.argumentLists = (ArgumentList *) calloc(loadedConfig.instructionTable.instructionCount + 1,
+													sizeof(ArgumentList));
+	ASSERT(context.argumentLists);
+	context.bashPool.isRebuildingCache = (optionFlags & OptionFlag_Rebuild_Cache);
+	initIoBatch(&context.ioBatch, ioDepth);
+
+	// TODO: If onlyArgs:
+	//       - Move instruction creation here.
+	//       - For each argv left:
+	//         If directory:
+	//           - If recursive, add content.
+	//           - If recursive and keep, add content BUT go to file part.
+	//         If file:
+	//           - Treat onlyArg element as extension:
+	//             - If file same extension, add file.
+	//             - If any file added, skip following step.
+	//           - Treat onlyArg element as tag:
+	//             - Get instruction by tag.
+	//             - If file extension in instruction extensions, add file.
+	//       - Save current index.
+	//       - Do same on recursive add, as soon as i == current index.
+	//
+	//       - Go to exectute (or make a function exectuteInstructions).
+
+	EntryList entryList = {};
+
+	// Entries given from argv.
+	for (int i = 0; i < argumentEntryCount; ++i)
+	{
+		char *argument = argv[optind + i];
+
+		addEntryFromArgument(&context, &entryList, argument, strlen(argument));
+	}
+
+	if (entryList.count)
+	{
+		processEntries(&context, &entryList);
+	}
+
+	if (optionFlags & OptionFlag_From_Stdin)
+	{
+		processEntriesFromStdin(&context, &entryList);
+	}
+
+	freeEntryList(&entryList);
+
+	waitForProcesses(&context, 0);
+	stopBashWorkers(&context.bashPool);
+	freeIoBatch(&context.ioBatch);
+
+	for (u32 index = 0; index < context.instructionTable->instructionCount; ++index)
+	{
+		free(context.argumentLists[index].arguments);
+	}
+
+	free(context.argumentLists);
+
+	if (optionFlags & OptionFlag_Stats)
+	{
+		fprintf(stderr, "%s: stat: %llu (avoided: %llu), opendir: %llu, type from readdir: %llu, spawn: %llu, "
+				"sniffed: %llu, io_uring_enter: %llu.\n", ME,
+				(unsigned long long) counters.statCount,
+				(unsigned long long) counters.statAvoidedCount,
+				(unsigned long long) counters.opendirCount,
+				(unsigned long long) counters.direntTypeCount,
+				(unsigned long long) counters.spawnCount,
+				(unsigned long long) counters.sniffCount,
+				(unsigned long long) counters.ioSubmitCount);
+	}
+
+#if XOPEN_PROFILE
+	if (isProfiling &&
+		!writeProfile(profileFile))
+	{
+		char buffer[255];
+		sprintf(buffer, "%s: --profile: could not write %.200s", ME, profileFile);
+		perror(buffer);
+	}
+#endif
+
+	saveCommandCache();
+
+	return 0;
+}
+
+static void refreshDaemon(void *data)
+{
+	LoadedConfig *config = (LoadedConfig *) data;
+	struct stat configStat;
+	b32 hasConfigStat = (stat(config->configFile, &configStat) == 0);
+
+	if ((hasConfigStat != config->hasConfigStat) ||
+		(hasConfigStat &&
+		 ((configStat.st_dev != config->configStat.st_dev) ||
+		  (configStat.st_ino != config->configStat.st_ino) ||
+		  (configStat.st_size != config->configStat.st_size) ||
+		  (configStat.st_mtim.tv_sec != config->configStat.st_mtim.tv_sec) ||
+		  (configStat.st_mtim.tv_nsec != config->configStat.st_mtim.tv_nsec))))
+	{
+		char configFile[255];
+		strcpy(configFile, config->configFile);
+
+		loadConfig(config, configFile, false);
+	}
+
+	// Resolve every command once, children find them in memory.
+	refreshCommandPaths();
+
+	InstructionTable *table = &config->instructionTable;
+
+	for (u32 index = 0; index < table->instructionCount; ++index)
+	{
+		char command[255];
+		char commandPath[255];
+
+		if (copyString(table, table->instructions[index].command, command, ARRAY_SIZE(command)))
+		{
+			resolveCommandPath(command, commandPath, ARRAY_SIZE(commandPath));
+		}
+	}
+
+	saveCommandCache();
+}
+
+static int handleDaemonRequest(int argc, char **argv, void *data)
+{
+	return xopenMain(argc, argv);
+}
+
+int main(int argc, char* argv[])
+{
+	char *programName = strrchr(argv[0], '/');
+	programName = programName ? programName + 1 : argv[0];
+
+	b32 isDaemon = (strcmp(programName, ME "d") == 0);
+	// NOTE: A baked config is loaded as fast as the daemon is reached.
+	b32 isForwarded = !XOPEN_BAKED;
+
+	// Only look at options: a file could be named --daemon.
+	for (int i = 1; (i < argc) && (strcmp(argv[i], "--") != 0); ++i)
+	{
+		if (strcmp(argv[i], "--daemon") == 0)
+		{
+			isDaemon = true;
+		}
+		else if (strcmp(argv[i], "--no-daemon") == 0)
+		{
+			isForwarded = false;
+		}
+	}
+
+	if (isDaemon)
+	{
+		char configFile[255];
+		int error = getConfigFile(configFile);
+
+		if (error ||
+			((error = loadConfig(&loadedConfig, configFile, false)) != 0))
+		{
+			return error;
+		}
+
+		return runDaemon(refreshDaemon, handleDaemonRequest, &loadedConfig);
+	}
+
+	int exitCode;
+
+	if (isForwarded &&
+		forwardToDaemon(argc, argv, &exitCode))
+	{
+		return exitCode;
+	}
+
+	return xopenMain(argc, argv);
 }
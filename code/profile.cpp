@@ -0,0 +1,108 @@
+#include "ef_utils.h"
+#include "profile.h"
+
+#if XOPEN_PROFILE
+
+#include <time.h>
+
+Profile profile = {};
+
+static char *phaseNames[ProfilePhase_Count] =
+{
+	"config_setup",
+	"config_load",
+	"config_parse",
+	"walk",
+	"classify",
+	"sniff",
+	"resolve",
+	"launch",
+	"bash_start",
+	"wait",
+};
+
+u64 getProfileTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (u64) now.tv_sec * 1000000000ull + (u64) now.tv_nsec;
+}
+
+void resetProfile()
+{
+	profile = {};
+	profile.startTime = getProfileTime();
+}
+
+void endProfilePhase(ProfilePhase phase, u64 startTime)
+{
+	ProfileTimer *timer = profile.timers + phase;
+	u64 time = getProfileTime() - startTime;
+
+	timer->totalTime += time;
+	timer->maxTime = MAX(timer->maxTime, time);
+	++timer->count;
+}
+
+// Nanoseconds as milliseconds, with 3 decimals.
+static void writeMilliseconds(FILE *handle, u64 time)
+{
+	u64 microseconds = time / 1000;
+
+	fprintf(handle, "%llu.%03llu",
+			(unsigned long long) (microseconds / 1000),
+			(unsigned long long) (microseconds % 1000));
+}
+
+b32 writeProfile(char *file)
+{
+	FILE *handle = file ? fopen(file, "w") : stderr;
+
+	if (!handle)
+	{
+		return false;
+	}
+
+	u64 totalTime = getProfileTime() - profile.startTime;
+
+	fprintf(handle, "{\"total_ms\": ");
+	writeMilliseconds(handle, totalTime);
+	fprintf(handle, ", \"phases\": {");
+
+	for (int i = 0; i < ProfilePhase_Count; ++i)
+	{
+		ProfileTimer *timer = profile.timers + i;
+
+		fprintf(handle, "%s\"%s\": {\"ms\": ", i ? ", " : "", phaseNames[i]);
+		writeMilliseconds(handle, timer->totalTime);
+		fprintf(handle, ", \"max_ms\": ");
+		writeMilliseconds(handle, timer->maxTime);
+		fprintf(handle, ", \"count\": %llu}", (unsigned long long) timer->count);
+	}
+
+	fprintf(handle,
+			"}, \"counters\": {\"entries\": %llu, \"stat\": %llu, \"stat_avoided\": %llu, \"opendir\": %llu, "
+			"\"type_from_readdir\": %llu, \"spawn\": %llu, \"sniffed\": %llu, "
+			"\"io_uring_enter\": %llu, \"config_bytes_parsed\": %llu}}\n",
+			(unsigned long long) profile.entryCount,
+			(unsigned long long) counters.statCount,
+			(unsigned long long) counters.statAvoidedCount,
+			(unsigned long long) counters.opendirCount,
+			(unsigned long long) counters.direntTypeCount,
+			(unsigned long long) counters.spawnCount,
+			(unsigned long long) counters.sniffCount,
+			(unsigned long long) counters.ioSubmitCount,
+			(unsigned long long) counters.configByteCount);
+
+	if (file)
+	{
+		return (fclose(handle) == 0);
+	}
+
+	fflush(handle);
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+#include "xopen_common.h"
+
+// Build with XOPEN_PROFILE=0 (make PROFILE=0) to compile --profile
+// out: the macros below then expand to nothing.
+#ifndef XOPEN_PROFILE
+#define XOPEN_PROFILE 1
+#endif
+
+enum ProfilePhase
+{
+	ProfilePhase_Config_Setup = 0, // Finding (or creating) the config file.
+	ProfilePhase_Config_Load,      // From its cache or parsed, then indexed.
+	ProfilePhase_Config_Parse,     // makeInstructionsFromConfig only.
+	ProfilePhase_Walk,             // Adding sub-directories.
+	ProfilePhase_Classify,         // Finding the instruction of entries.
+	ProfilePhase_Sniff,            // Reading files (part of classify).
+	ProfilePhase_Resolve,          // Finding commands in $PATH.
+	ProfilePhase_Launch,           // Each spawn, or function sent to bash.
+	ProfilePhase_Bash_Start,       // Starting a bash worker (part of launch).
+	ProfilePhase_Wait,             // Waiting for programs and functions.
+
+	ProfilePhase_Count,
+};
+
+#if XOPEN_PROFILE
+
+struct ProfileTimer
+{
+	u64 totalTime;
+	u64 maxTime;
+	u64 count;
+};
+
+// NOTE: Only recorded by the main thread. Times are in nanoseconds.
+struct Profile
+{
+	u64 startTime;
+	ProfileTimer timers[ProfilePhase_Count];
+	u64 entryCount;
+};
+
+extern Profile profile;
+
+// CLOCK_MONOTONIC, in nanoseconds.
+u64 getProfileTime();
+
+void resetProfile();
+void endProfilePhase(ProfilePhase phase, u64 startTime);
+
+// Write everything recorded since resetProfile (and counters) as a
+// single JSON record to file, or stderr if file is NULL. Return false
+// if file could not be written.
+b32 writeProfile(char *file);
+
+#define PROFILE_RESET() resetProfile()
+#define PROFILE_BEGIN(phase) u64 JOIN(profileStart_, phase) = getProfileTime()
+#define PROFILE_END(phase) endProfilePhase(JOIN(ProfilePhase_, phase), JOIN(profileStart_, phase))
+#define PROFILE_COUNT_ENTRIES(count) (profile.entryCount += (count))
+
+#else
+
+#define PROFILE_RESET()
+#define PROFILE_BEGIN(phase)
+#define PROFILE_END(phase)
+#define PROFILE_COUNT_ENTRIES(count)
+
+#endif
+
+#endif
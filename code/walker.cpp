@@ -0,0 +1,488 @@
+#include "ef_utils.h"
+#include "walker.h"
+
+#include "io_batch.h"
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/*
+  Each thread owns a deque of directories still to be scanned.
+  It pushes the sub-directories it finds at the bottom and pops from
+  the bottom as well (depth-first, so paths stay hot in the cache).
+  Idle threads steal from the top of the others' deques (the oldest
+  directories, which are usually the biggest pieces of work).
+
+  pendingCount is the number of directories pushed but not yet fully
+  scanned: a sub-directory is counted before its parent is done, so
+  it only reaches 0 when the whole tree has been walked.
+
+  A thread which finds nothing to steal while directories are still
+  pending sleeps on workCondition (one thread may be stuck in a big or
+  slow directory for long). It is woken when a directory is pushed
+  (pushCount changed since it looked) or when pendingCount reaches 0.
+  NOTE: Pushers only take idleMutex if a thread is idle: pushCount and
+        idleCount are stored then loaded in opposite orders (SEQ_CST),
+        so either the pusher sees the idle thread, or the idle thread
+        sees the push before it sleeps.
+*/
+
+struct WorkDeque
+{
+	pthread_mutex_t mutex;
+
+	char **directories;
+	int top;
+	int bottom;
+	int capacity;
+};
+
+struct Walker
+{
+	WorkDeque *deques;
+	WalkOutput *outputs;
+	int threadCount;
+
+	b32 keepDirectories;
+
+	long pendingCount;
+
+	pthread_mutex_t idleMutex;
+	pthread_cond_t workCondition;
+	u64 pushCount;
+	int idleCount;
+};
+
+struct WalkerThread
+{
+	Walker *walker;
+	int index;
+
+	IoBatch ioBatch;
+
+	// Path of the entry being scanned, grown as needed (no limit, like
+	// the entries of a serial walk).
+	char *path;
+	size_t pathCapacity;
+
+	char *unknownNames;
+	size_t unknownNamesSize;
+	size_t unknownNamesCapacity;
+	int unknownCount;
+
+	pthread_t handle;
+	b32 isStarted;
+};
+
+static void pushBottom(WorkDeque *deque, char *directory)
+{
+	pthread_mutex_lock(&deque->mutex);
+
+	if (deque->bottom == deque->capacity)
+	{
+		if (deque->top > 0)
+		{
+			memmove(deque->directories, deque->directories + deque->top,
+					(deque->bottom - deque->top) * sizeof(char *));
+			deque->bottom -= deque->top;
+			deque->top = 0;
+		}
+		else
+		{
+			deque->capacity = deque->capacity ? 2 * deque->capacity : 64;
+			deque->directories = (char **) realloc(deque->directories,
+												   deque->capacity * sizeof(char *));
+			ASSERT(deque->directories);
+		}
+	}
+
+	deque->directories[deque->bottom++] = directory;
+
+	pthread_mutex_unlock(&deque->mutex);
+}
+
+static char *popBottom(WorkDeque *deque)
+{
+	char *directory = NULL;
+
+	pthread_mutex_lock(&deque->mutex);
+
+	if (deque->bottom > deque->top)
+	{
+		directory = deque->directories[--deque->bottom];
+	}
+
+	pthread_mutex_unlock(&deque->mutex);
+
+	return directory;
+}
+
+static char *stealTop(WorkDeque *deque, b32 *isBusy)
+{
+	char *directory = NULL;
+
+	// Do not wait on a busy deque, try the next one instead.
+	if (pthread_mutex_trylock(&deque->mutex) != 0)
+	{
+		*isBusy = true;
+		return NULL;
+	}
+
+	if (deque->bottom > deque->top)
+	{
+		directory = deque->directories[deque->top++];
+	}
+
+	pthread_mutex_unlock(&deque->mutex);
+
+	return directory;
+}
+
+EntryType statEntryType(char *path)
+{
+	struct stat entryStat;
+
+	__atomic_add_fetch(&counters.statCount, 1, __ATOMIC_RELAXED);
+
+	if ((stat(path, &entryStat) == 0) &&
+		S_ISDIR(entryStat.st_mode))
+	{
+		return EntryType_Directory;
+	}
+
+	return EntryType_File;
+}
+
+EntryType getDirentEntryType(struct dirent *entry)
+{
+	switch (entry->d_type)
+	{
+		case DT_UNKNOWN:
+		case DT_LNK:
+		{
+			return EntryType_Unknown;
+		}
+		case DT_DIR:
+		{
+			__atomic_add_fetch(&counters.direntTypeCount, 1, __ATOMIC_RELAXED);
+			return EntryType_Directory;
+		}
+		default:
+		{
+			__atomic_add_fetch(&counters.direntTypeCount, 1, __ATOMIC_RELAXED);
+			return EntryType_File;
+		}
+	}
+}
+
+static void appendOutput(WalkOutput *output, char *path, size_t length, EntryType type)
+{
+	if (output->count == output->typesCapacity)
+	{
+		output->typesCapacity = output->typesCapacity ? 2 * output->typesCapacity : 1024;
+		output->types = (u8 *) realloc(output->types, output->typesCapacity);
+		ASSERT(output->types);
+	}
+
+	output->types[output->count] = (u8) type;
+
+	if (output->size + length + 1 > output->capacity)
+	{
+		output->capacity = MAX(2 * output->capacity, output->size + length + 1 + 4096);
+		output->paths = (char *) realloc(output->paths, output->capacity);
+		ASSERT(output->paths);
+	}
+
+	memcpy(output->paths + output->size, path, length + 1);
+	output->size += length + 1;
+	++output->count;
+}
+
+static void addScannedEntry(Walker *walker, int threadIndex, char *path, size_t length, EntryType type)
+{
+	if (type == EntryType_Directory)
+	{
+		if (walker->keepDirectories)
+		{
+			appendOutput(walker->outputs + threadIndex, path, length, EntryType_Directory);
+		}
+
+		__atomic_add_fetch(&walker->pendingCount, 1, __ATOMIC_SEQ_CST);
+		pushBottom(walker->deques + threadIndex, strdup(path));
+
+		__atomic_add_fetch(&walker->pushCount, 1, __ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n(&walker->idleCount, __ATOMIC_SEQ_CST))
+		{
+			pthread_mutex_lock(&walker->idleMutex);
+			pthread_cond_signal(&walker->workCondition);
+			pthread_mutex_unlock(&walker->idleMutex);
+		}
+	}
+	else
+	{
+		appendOutput(walker->outputs + threadIndex, path, length, EntryType_File);
+	}
+}
+
+static void scanDirectory(Walker *walker, WalkerThread *thread, char *directory)
+{
+	DIR *d = opendir(directory);
+
+	__atomic_add_fetch(&counters.opendirCount, 1, __ATOMIC_RELAXED);
+
+	if (!d)
+	{
+		return;
+	}
+
+	struct dirent *dir;
+	size_t directoryLength = strlen(directory);
+
+	// Entries readdir does not give the type of, stat'ed together
+	// once the directory is read.
+	thread->unknownCount = 0;
+	thread->unknownNamesSize = 0;
+
+	while ((dir = readdir(d)) != NULL)
+	{
+		// Current and previous directory.
+		if ((strcmp(dir->d_name, ".") == 0) ||
+			(strcmp(dir->d_name, "..") == 0))
+		{
+			continue;
+		}
+
+		size_t nameLength = strlen(dir->d_name);
+		size_t length = directoryLength + 1 + nameLength;
+
+		if (length + 1 > thread->pathCapacity)
+		{
+			thread->pathCapacity = MAX(2 * thread->pathCapacity, length + 1 + 256);
+			thread->path = (char *) realloc(thread->path, thread->pathCapacity);
+			ASSERT(thread->path);
+		}
+
+		char *buffer = thread->path;
+
+		memcpy(buffer, directory, directoryLength);
+		buffer[directoryLength] = '/';
+		memcpy(buffer + directoryLength + 1, dir->d_name, nameLength + 1);
+
+		EntryType type = getDirentEntryType(dir);
+
+		if (type != EntryType_Unknown)
+		{
+			addScannedEntry(walker, thread->index, buffer, length, type);
+			continue;
+		}
+
+		if (thread->unknownNamesSize + length + 1 > thread->unknownNamesCapacity)
+		{
+			thread->unknownNamesCapacity = MAX(2 * thread->unknownNamesCapacity,
+											   thread->unknownNamesSize + length + 1 + 4096);
+			thread->unknownNames = (char *) realloc(thread->unknownNames, thread->unknownNamesCapacity);
+			ASSERT(thread->unknownNames);
+		}
+
+		memcpy(thread->unknownNames + thread->unknownNamesSize, buffer, length + 1);
+		thread->unknownNamesSize += length + 1;
+		++thread->unknownCount;
+	}
+
+	closedir(d);
+
+	if (thread->unknownCount)
+	{
+		char **paths = (char **) malloc(thread->unknownCount * sizeof(char *));
+		u8 *types = (u8 *) malloc(thread->unknownCount);
+		ASSERT(paths && types);
+
+		char *path = thread->unknownNames;
+
+		for (int i = 0; i < thread->unknownCount; ++i)
+		{
+			paths[i] = path;
+			path += strlen(path) + 1;
+		}
+
+		statEntryTypes(&thread->ioBatch, AT_FDCWD, paths, thread->unknownCount, types);
+
+		for (int i = 0; i < thread->unknownCount; ++i)
+		{
+			addScannedEntry(walker, thread->index, paths[i], strlen(paths[i]), (EntryType) types[i]);
+		}
+
+		free(paths);
+		free(types);
+	}
+}
+
+static void *walkerThreadProc(void *parameter)
+{
+	WalkerThread *thread = (WalkerThread *) parameter;
+	Walker *walker = thread->walker;
+	int threadIndex = thread->index;
+
+	for (;;)
+	{
+		// Before looking: a push after this is waited for below.
+		u64 pushCount = __atomic_load_n(&walker->pushCount, __ATOMIC_SEQ_CST);
+
+		char *directory = popBottom(walker->deques + threadIndex);
+		b32 isBusy = false;
+
+		for (int offset = 1; !directory && (offset < walker->threadCount); ++offset)
+		{
+			directory = stealTop(walker->deques + (threadIndex + offset) % walker->threadCount, &isBusy);
+		}
+
+		if (directory)
+		{
+			scanDirectory(walker, thread, directory);
+			free(directory);
+
+			if (__atomic_sub_fetch(&walker->pendingCount, 1, __ATOMIC_SEQ_CST) == 0)
+			{
+				pthread_mutex_lock(&walker->idleMutex);
+				pthread_cond_broadcast(&walker->workCondition);
+				pthread_mutex_unlock(&walker->idleMutex);
+			}
+		}
+		else if (__atomic_load_n(&walker->pendingCount, __ATOMIC_SEQ_CST) == 0)
+		{
+			break;
+		}
+		else if (!isBusy)
+		{
+			// Nothing to steal. NOTE: If a deque was busy, it may have
+			//       had a directory: it is looked at again instead.
+			pthread_mutex_lock(&walker->idleMutex);
+			__atomic_add_fetch(&walker->idleCount, 1, __ATOMIC_SEQ_CST);
+
+			while ((__atomic_load_n(&walker->pushCount, __ATOMIC_SEQ_CST) == pushCount) &&
+				   (__atomic_load_n(&walker->pendingCount, __ATOMIC_SEQ_CST) != 0))
+			{
+				pthread_cond_wait(&walker->workCondition, &walker->idleMutex);
+			}
+
+			__atomic_sub_fetch(&walker->idleCount, 1, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&walker->idleMutex);
+		}
+	}
+
+	return NULL;
+}
+
+void walkDirectories(char **directories, int directoryCount, int threadCount,
+					 u32 ioDepth, b32 keepDirectories, WalkOutput *output)
+{
+	ASSERT(threadCount > 0);
+
+	Walker walker = {};
+	walker.threadCount = threadCount;
+	walker.keepDirectories = keepDirectories;
+	walker.deques = (WorkDeque *) calloc(threadCount, sizeof(WorkDeque));
+	walker.outputs = (WalkOutput *) calloc(threadCount, sizeof(WalkOutput));
+	walker.pendingCount = directoryCount;
+
+	ASSERT(walker.deques && walker.outputs);
+
+	pthread_mutex_init(&walker.idleMutex, NULL);
+	pthread_cond_init(&walker.workCondition, NULL);
+
+	for (int i = 0; i < threadCount; ++i)
+	{
+		pthread_mutex_init(&walker.deques[i].mutex, NULL);
+	}
+
+	for (int i = 0; i < directoryCount; ++i)
+	{
+		pushBottom(walker.deques + (i % threadCount), strdup(directories[i]));
+	}
+
+	WalkerThread *threads = (WalkerThread *) calloc(threadCount, sizeof(WalkerThread));
+	ASSERT(threads);
+
+	// The calling thread is thread 0. If a thread fails to start,
+	// its deque is emptied by the others.
+	for (int i = 0; i < threadCount; ++i)
+	{
+		threads[i].walker = &walker;
+		threads[i].index = i;
+		initIoBatch(&threads[i].ioBatch, ioDepth);
+		threads[i].isStarted = ((i > 0) &&
+								(pthread_create(&threads[i].handle, NULL,
+												walkerThreadProc, threads + i) == 0));
+	}
+
+	walkerThreadProc(threads);
+
+	for (int i = 1; i < threadCount; ++i)
+	{
+		if (threads[i].isStarted)
+		{
+			pthread_join(threads[i].handle, NULL);
+		}
+	}
+
+	for (int i = 0; i < threadCount; ++i)
+	{
+		freeIoBatch(&threads[i].ioBatch);
+		free(threads[i].path);
+		free(threads[i].unknownNames);
+	}
+
+	// Merge per-thread outputs.
+	*output = {};
+
+	for (int i = 0; i < threadCount; ++i)
+	{
+		output->size += walker.outputs[i].size;
+		output->count += walker.outputs[i].count;
+	}
+
+	output->capacity = output->size;
+	output->paths = (char *) malloc(MAX(output->capacity, 1));
+	output->typesCapacity = output->count;
+	output->types = (u8 *) malloc(MAX(output->typesCapacity, 1));
+	ASSERT(output->paths && output->types);
+
+	size_t offset = 0;
+	int typeOffset = 0;
+
+	for (int i = 0; i < threadCount; ++i)
+	{
+		WalkOutput *threadOutput = walker.outputs + i;
+
+		if (threadOutput->size)
+		{
+			memcpy(output->paths + offset, threadOutput->paths, threadOutput->size);
+			offset += threadOutput->size;
+
+			memcpy(output->types + typeOffset, threadOutput->types, threadOutput->count);
+			typeOffset += threadOutput->count;
+		}
+
+		free(threadOutput->paths);
+		free(threadOutput->types);
+
+		pthread_mutex_destroy(&walker.deques[i].mutex);
+		free(walker.deques[i].directories);
+	}
+
+	pthread_cond_destroy(&walker.workCondition);
+	pthread_mutex_destroy(&walker.idleMutex);
+
+	free(threads);
+	free(walker.outputs);
+	free(walker.deques);
+}
+
+void freeWalkOutput(WalkOutput *output)
+{
+	free(output->paths);
+	free(output->types);
+	*output = {};
+}
@@ -0,0 +1,40 @@
+#ifndef WALKER_H
+#define WALKER_H
+#include "xopen_common.h"
+
+#include <dirent.h>
+
+// Entries found by walkDirectories (nul-terminated, one after the
+// other), and their type (one per entry).
+struct WalkOutput
+{
+	char *paths;
+	size_t size;
+	size_t capacity;
+
+	u8 *types;
+	int count;
+	int typesCapacity;
+};
+
+// Recursively add the content of each directory in directories to
+// output, using threadCount threads. Sub-directories themselves are
+// only added if keepDirectories is true.
+// NOTE: The set of entries is the same as with a serial walk, but
+//       their order depends on scheduling.
+// Types readdir does not give are stat'ed by batches of ioDepth
+// (see io_batch.h).
+void walkDirectories(char **directories, int directoryCount, int threadCount,
+					 u32 ioDepth, b32 keepDirectories, WalkOutput *output);
+
+void freeWalkOutput(WalkOutput *output);
+
+// stat(2) path (following symlinks), EntryType_File if it fails.
+EntryType statEntryType(char *path);
+
+// Type of an entry returned by readdir, EntryType_Unknown for
+// symlinks (to be followed, like stat) and filesystems that do not
+// fill d_type: these have to be stat'ed.
+EntryType getDirentEntryType(struct dirent *entry);
+
+#endif
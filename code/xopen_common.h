@@ -3,24 +3,49 @@
 
 #define ME "xopen"
 
+enum EntryType
+{
+	EntryType_Unknown = 0,
+	EntryType_File,
+	EntryType_Directory,
+};
+
+// NOTE: Updated with __atomic builtins, the walker is multi-threaded.
+struct Counters
+{
+	u64 statCount;
+	u64 statAvoidedCount; // Types not needed, or given by a trailing '/'.
+	u64 opendirCount;
+	u64 direntTypeCount; // Entries whose type came from readdir.
+	u64 spawnCount;
+	u64 sniffCount; // Files whose start was read (see magic.cpp).
+	u64 ioSubmitCount; // io_uring_enter calls (see io_batch.cpp).
+	u64 configByteCount; // Bytes of config parsed (not from its cache).
+};
+
+extern Counters counters;
+
+// NOTE: A string of InstructionTable::strings, of length bytes: it may
+//       be a view into the mapped config, not terminated (use
+//       copyString to get one that is).
+struct StringRef
+{
+	u32 offset;
+	u32 length;
+};
+
+// NOTE: Only what the config file says; what is found at runtime
+//       (command path, arguments) is kept by the caller, per
+//       instruction index. Also the layout of the config cache.
 struct Instruction
 {
-	char command[255];
-	char commandPath[255];
-	size_t extensionsLength[255];
-
-	char extensions[255][64];
-
-	// TODO: Actually get the number of arguments.
-	char *arguments[255];
-	
-	int commandLength;
-	int argumentCount;
-	int extensionCount;
-
-	// NOTE: Only one tag for now.
-	char *tag;
-	size_t tagLength;
+	StringRef command;
+	// NOTE: Only one tag for now. length is 0 if none.
+	StringRef tag;
+
+	// Extensions are InstructionTable::extensions[extensionFirst...].
+	u32 extensionFirst;
+	u32 extensionCount;
 };
 
 #endif
@@ -0,0 +1,321 @@
+// Check that the SSE2 and AVX2 classifiers of the config parser give the
+// same masks as the scalar one, and that tokenizing with each of them
+// gives the token stream of a byte by byte tokenizer (see "make test").
+//
+// usage: config_classify_test [SEED]
+//
+// NOTE: The classifiers and the tokenizer are static: the parser is
+//       included whole.
+
+#include "config_file_parser.cpp"
+
+Counters counters = {};
+
+struct Classifier
+{
+	char *name;
+	ClassifyBlockProc *classifyBlock;
+};
+
+static Classifier classifiers[3];
+static int classifierCount;
+
+static int failureCount;
+
+// Blocks of the buffers below (so runs cross block and 16/32 byte
+// chunk boundaries).
+#define TEST_BLOCK_COUNT 4
+#define TEST_SIZE (TEST_BLOCK_COUNT * CLASSIFY_BLOCK_SIZE)
+
+// Text of size bytes, followed by '\0' and padded like a mapped config.
+static char *makeBuffer(char *text, size_t size)
+{
+	size_t bufferSize = (size + 1 + CLASSIFY_BLOCK_SIZE - 1) / CLASSIFY_BLOCK_SIZE * CLASSIFY_BLOCK_SIZE;
+	char *buffer = (char *) calloc(bufferSize + CLASSIFY_BLOCK_SIZE, 1);
+	ASSERT(buffer);
+
+	memcpy(buffer, text, size);
+
+	return buffer;
+}
+
+static void fail(char *test, char *classifier, char *format, ...)
+{
+	va_list arguments;
+	va_start(arguments, format);
+
+	fprintf(stderr, "config_classify_test: %s (%s): ", test, classifier);
+	vfprintf(stderr, format, arguments);
+	fprintf(stderr, "\n");
+
+	va_end(arguments);
+
+	++failureCount;
+}
+
+// Masks of every classifier against the scalar one.
+static void compareMasks(char *test, char *text, size_t size)
+{
+	char *buffer = makeBuffer(text, size);
+	CharacterMasks expected;
+
+	classifyCharacters(&expected, buffer, size, classifyBlockScalar);
+
+	size_t wordCount = (size + 1 + CLASSIFY_BLOCK_SIZE - 1) / CLASSIFY_BLOCK_SIZE;
+
+	for (int c = 0; c < classifierCount; ++c)
+	{
+		CharacterMasks masks;
+		classifyCharacters(&masks, buffer, size, classifiers[c].classifyBlock);
+
+		for (size_t i = 0; i < wordCount; ++i)
+		{
+			if ((masks.whitespace[i] != expected.whitespace[i]) ||
+				(masks.literal[i] != expected.literal[i]) ||
+				(masks.endOfLine[i] != expected.endOfLine[i]) ||
+				(masks.endOfWord[i] != expected.endOfWord[i]))
+			{
+				fail(test, classifiers[c].name,
+					 "word %zu: whitespace %016llx literal %016llx end of line %016llx, "
+					 "expected %016llx %016llx %016llx", i,
+					 (unsigned long long) masks.whitespace[i], (unsigned long long) masks.literal[i],
+					 (unsigned long long) masks.endOfLine[i],
+					 (unsigned long long) expected.whitespace[i], (unsigned long long) expected.literal[i],
+					 (unsigned long long) expected.endOfLine[i]);
+				break;
+			}
+		}
+
+		freeCharacterMasks(&masks);
+	}
+
+	freeCharacterMasks(&expected);
+	free(buffer);
+}
+
+// What getNextToken does, one byte at a time (no masks).
+static Token getNextTokenByByte(char **at)
+{
+	Token token = {};
+
+	do
+	{
+		while (isWhitespace(**at))
+		{
+			++(*at);
+		}
+
+		token.length = 1;
+		token.text = *at;
+
+		switch (**at)
+		{
+			case '\0': {token.type	= Token_EOF; return token;	break;}
+
+			case '-': {token.type	= Token_Minus;				break;}
+			case '(': {token.type	= Token_OpenParenthesis;	break;}
+			case ')': {token.type	= Token_CloseParenthesis;	break;}
+			case '%': {token.type	= Token_Percent;			break;}
+			case '\n': {token.type	= Token_Newline;			break;}
+			case '#':
+			case '@':
+			{
+				token.type = (**at == '#') ? Token_LineComment : Token_Tag;
+				token.text = ++(*at);
+
+				while (**at &&
+					   !isEndOfLine(**at) &&
+					   ((token.type == Token_LineComment) || !isWhitespace(**at)))
+				{
+					++(*at);
+				}
+
+				token.length = *at - token.text;
+				--(*at);
+
+				break;
+			}
+			default:
+			{
+				if (isValidLiteralChar(**at))
+				{
+					token.type = Token_Literal;
+
+					while (isValidLiteralChar(**at))
+					{
+						++(*at);
+					}
+
+					token.length = *at - token.text;
+					--(*at);
+				}
+				else
+				{
+					token.type = Token_Unknown;
+				}
+
+				break;
+			}
+		}
+
+		++(*at);
+	} while (token.type == Token_LineComment);
+
+	return token;
+}
+
+// Tokens of every classifier against the byte by byte tokenizer.
+static void compareTokens(char *test, char *text, size_t size)
+{
+	char *buffer = makeBuffer(text, size);
+
+	for (int c = 0; c < classifierCount; ++c)
+	{
+		Tokenizer tokenizer = {};
+		tokenizer.start = buffer;
+		tokenizer.at = buffer;
+		classifyCharacters(&tokenizer.masks, buffer, size, classifiers[c].classifyBlock);
+
+		char *at = buffer;
+
+		for (int index = 0;; ++index)
+		{
+			Token expected = getNextTokenByByte(&at);
+			Token token = getNextToken(&tokenizer);
+
+			if ((token.type != expected.type) ||
+				(token.text != expected.text) ||
+				(token.length != expected.length))
+			{
+				fail(test, classifiers[c].name,
+					 "token %d: type %d at %td (%zu bytes), expected type %d at %td (%zu bytes)", index,
+					 token.type, token.text - buffer, token.length,
+					 expected.type, expected.text - buffer, expected.length);
+				break;
+			}
+
+			if (token.type == Token_EOF)
+			{
+				break;
+			}
+		}
+
+		freeCharacterMasks(&tokenizer.masks);
+	}
+
+	free(buffer);
+}
+
+int main(int argc, char **argv)
+{
+	u32 seed = (argc > 1) ? (u32) atoi(argv[1]) : 1;
+
+	classifiers[classifierCount++] = {"scalar", classifyBlockScalar};
+#if HAS_VECTOR_CLASSIFY
+	classifiers[classifierCount++] = {"sse2", classifyBlock16};
+
+	if (__builtin_cpu_supports("avx2"))
+	{
+		classifiers[classifierCount++] = {"avx2", classifyBlock32};
+	}
+	else
+	{
+		printf("config_classify_test: no AVX2 on this CPU, not tested.\n");
+	}
+#else
+	printf("config_classify_test: built without SSE2, only the scalar classifier is tested.\n");
+#endif
+
+	char text[TEST_SIZE];
+
+	// Every byte value at every position of a block, among literal
+	// characters and among spaces. Covers the range compares ('-' and
+	// ':' around '.'-'9', '@' '[' '`' '{' around letters, which OR 0x20
+	// must not make letters) and bytes >= 0x80 (signed compares).
+	char fillers[] = {'a', ' '};
+
+	for (u32 f = 0; f < ARRAY_SIZE(fillers); ++f)
+	{
+		for (int value = 1; value < 256; ++value)
+		{
+			memset(text, fillers[f], sizeof(text));
+
+			for (int position = 0; position < TEST_SIZE; position += 7)
+			{
+				text[position] = (char) value;
+			}
+
+			// Both ends of every 16 and 32 byte chunk.
+			for (int position = 0; position < TEST_SIZE; position += 16)
+			{
+				text[position] = (char) value;
+				text[position + 15] = (char) value;
+			}
+
+			char test[64];
+			sprintf(test, "byte 0x%02x among '%c'", value, fillers[f]);
+
+			compareMasks(test, text, sizeof(text));
+			compareTokens(test, text, sizeof(text));
+		}
+	}
+
+	// Runs ending on each side of chunk boundaries, and texts of
+	// every size around blocks (the '\0' then padding).
+	char *runs[] = {"cmd", "tar.gz", "*.min.js", "@tag", "# comment", "-", " ", "\t", "\r\n", "\n", "(", "%",
+					"0123456789", "./-:", "x/y"};
+
+	for (int size = 0; size < TEST_SIZE; ++size)
+	{
+		for (int trial = 0; trial < 8; ++trial)
+		{
+			int length = 0;
+
+			while (length < size)
+			{
+				seed = seed * 1103515245u + 12345u;
+
+				char *run = runs[(seed >> 16) % ARRAY_SIZE(runs)];
+				int runLength = MIN((int) strlen(run), size - length);
+
+				memcpy(text + length, run, runLength);
+				length += runLength;
+			}
+
+			char test[64];
+			sprintf(test, "%d bytes of runs, trial %d", size, trial);
+
+			compareMasks(test, text, size);
+			compareTokens(test, text, size);
+		}
+	}
+
+	// Random bytes (a '\0' ends the config).
+	for (int trial = 0; trial < 2000; ++trial)
+	{
+		for (int i = 0; i < TEST_SIZE; ++i)
+		{
+			seed = seed * 1103515245u + 12345u;
+			text[i] = (char) (seed >> 24);
+		}
+
+		seed = seed * 1103515245u + 12345u;
+
+		int size = (seed >> 8) % (TEST_SIZE + 1);
+		char test[64];
+		sprintf(test, "%d random bytes, trial %d", size, trial);
+
+		compareMasks(test, text, size);
+		compareTokens(test, text, size);
+	}
+
+	if (failureCount)
+	{
+		printf("config_classify_test: %d failures.\n", failureCount);
+		return 1;
+	}
+
+	printf("config_classify_test: OK (%d classifiers).\n", classifierCount);
+
+	return 0;
+}
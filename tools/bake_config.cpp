@@ -0,0 +1,432 @@
+// Turn a config into a header for "make baked" (see code/Makefile): the
+// tables of its instructions and a perfect hash of their extensions
+// (see instruction_index.h), so xopen-baked has nothing to read, parse
+// or index when it starts.
+//
+// usage: bake_config CONFIG HEADER
+
+#include "ef_utils.h"
+#include "config_file_parser.h"
+#include "instruction_table.h"
+#include "instruction_index.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+Counters counters = {};
+
+// Displacements tried for a bucket before starting again with another
+// basis, then with more slots.
+#define MAX_DISPLACEMENT_TRIES (1u << 16)
+#define MAX_BASIS_TRIES 8
+#define MAX_SLOT_DOUBLINGS 3
+
+struct Key
+{
+	StringRef string;
+	i32 instructionIndex;
+	u64 hash;
+};
+
+struct BakedHash
+{
+	PerfectHash hash;
+
+	u32 *displacements;
+	u32 bucketCount;
+
+	PerfectHashSlot *slots;
+	u32 slotCount;
+};
+
+// Shift of a 64 bits hash to get an index in count.
+static u32 getShift(u32 count)
+{
+	u32 shift = 64;
+
+	while (count > 1)
+	{
+		count >>= 1;
+		--shift;
+	}
+
+	return shift;
+}
+
+// NOTE: The first instruction (in config order) keeps a key, like in
+//       the runtime index. Strings of table are interned: equal keys
+//       have the same offset.
+static u32 collectKeys(InstructionTable *table, Key *keys)
+{
+	b32 *isSeen = (b32 *) calloc(table->stringsSize, sizeof(b32));
+	ASSERT(isSeen);
+
+	u32 keyCount = 0;
+
+	for (u32 i = 0; i < table->instructionCount; ++i)
+	{
+		Instruction *instruction = table->instructions + i;
+		StringRef *extensions = getExtensions(table, instruction);
+
+		for (u32 extensionIndex = 0; extensionIndex < instruction->extensionCount; ++extensionIndex)
+		{
+			StringRef string = extensions[extensionIndex];
+
+			if (!isSeen[string.offset])
+			{
+				isSeen[string.offset] = true;
+				keys[keyCount++] = {string, (i32) i, 0};
+			}
+		}
+	}
+
+	free(isSeen);
+
+	return keyCount;
+}
+
+// Place the keys of each bucket, the biggest buckets first (they are
+// the hardest to place). Return false if one can't be placed.
+static b32 placeKeys(BakedHash *baked, Key *keys, u32 keyCount)
+{
+	PerfectHash *hash = &baked->hash;
+
+	u32 *bucketFirsts = (u32 *) calloc(baked->bucketCount + 1, sizeof(u32));
+	Key **bucketKeys = (Key **) malloc((keyCount + 1) * sizeof(Key *));
+	u32 *keySlots = (u32 *) malloc((keyCount + 1) * sizeof(u32));
+	ASSERT(bucketFirsts && bucketKeys && keySlots);
+
+	// Counting sort of the keys by bucket.
+	u32 maxBucketSize = 0;
+
+	for (u32 i = 0; i < keyCount; ++i)
+	{
+		++bucketFirsts[getPerfectHashBucket(hash, keys[i].hash) + 1];
+	}
+
+	for (u32 bucket = 0; bucket < baked->bucketCount; ++bucket)
+	{
+		if (bucketFirsts[bucket + 1] > maxBucketSize)
+		{
+			maxBucketSize = bucketFirsts[bucket + 1];
+		}
+
+		bucketFirsts[bucket + 1] += bucketFirsts[bucket];
+	}
+
+	for (u32 i = 0; i < keyCount; ++i)
+	{
+		u32 bucket = getPerfectHashBucket(hash, keys[i].hash);
+		u32 first = bucketFirsts[bucket];
+
+		// Shifted back below.
+		bucketKeys[first] = keys + i;
+		++bucketFirsts[bucket];
+	}
+
+	for (u32 bucket = baked->bucketCount; bucket > 0; --bucket)
+	{
+		bucketFirsts[bucket] = bucketFirsts[bucket - 1];
+	}
+
+	bucketFirsts[0] = 0;
+
+	for (u32 i = 0; i < baked->slotCount; ++i)
+	{
+		baked->slots[i] = {0, 0, -1};
+	}
+
+	b32 isPlaced = true;
+
+	for (u32 size = maxBucketSize; isPlaced && (size > 0); --size)
+	{
+		for (u32 bucket = 0; isPlaced && (bucket < baked->bucketCount); ++bucket)
+		{
+			u32 first = bucketFirsts[bucket];
+
+			if (bucketFirsts[bucket + 1] - first != size)
+			{
+				continue;
+			}
+
+			isPlaced = false;
+
+			for (u32 displacement = 0; !isPlaced && (displacement < MAX_DISPLACEMENT_TRIES); ++displacement)
+			{
+				u32 placedCount = 0;
+
+				for (; placedCount < size; ++placedCount)
+				{
+					u32 slot = getPerfectHashSlot(hash, bucketKeys[first + placedCount]->hash, displacement);
+
+					if (baked->slots[slot].instructionIndex != -1)
+					{
+						break;
+					}
+
+					// Taken until the bucket is placed (or not).
+					baked->slots[slot].instructionIndex = -2;
+					keySlots[placedCount] = slot;
+				}
+
+				isPlaced = (placedCount == size);
+
+				for (u32 i = 0; i < placedCount; ++i)
+				{
+					Key *key = bucketKeys[first + i];
+
+					baked->slots[keySlots[i]] = isPlaced
+						? PerfectHashSlot{key->string.offset, key->string.length, key->instructionIndex}
+						: PerfectHashSlot{0, 0, -1};
+				}
+
+				if (isPlaced)
+				{
+					baked->displacements[bucket] = displacement;
+				}
+			}
+		}
+	}
+
+	free(bucketFirsts);
+	free(bucketKeys);
+	free(keySlots);
+
+	return isPlaced;
+}
+
+// Return false if no perfect hash was found (keys sharing a hash).
+static b32 bakeHash(BakedHash *baked, InstructionTable *table, Key *keys, u32 keyCount)
+{
+	*baked = {};
+
+	// NOTE: 2 keys per bucket on average, a load factor under 0.8.
+	baked->bucketCount = 2;
+	baked->slotCount = 16;
+
+	while (baked->bucketCount < keyCount / 2)
+	{
+		baked->bucketCount <<= 1;
+	}
+
+	while (baked->slotCount < keyCount + keyCount / 4)
+	{
+		baked->slotCount <<= 1;
+	}
+
+	for (u32 doubling = 0; doubling <= MAX_SLOT_DOUBLINGS; ++doubling)
+	{
+		baked->displacements = (u32 *) calloc(baked->bucketCount, sizeof(u32));
+		baked->slots = (PerfectHashSlot *) malloc(baked->slotCount * sizeof(PerfectHashSlot));
+		ASSERT(baked->displacements && baked->slots);
+
+		baked->hash.bucketShift = getShift(baked->bucketCount);
+		baked->hash.slotShift = getShift(baked->slotCount);
+
+		for (u32 basisTry = 0; basisTry < MAX_BASIS_TRIES; ++basisTry)
+		{
+			baked->hash.basis = 14695981039346656037ull ^ (basisTry * 11400714819323198485ull);
+
+			for (u32 i = 0; i < keyCount; ++i)
+			{
+				keys[i].hash = hashPerfectKey(getString(table, keys[i].string), keys[i].string.length,
+											  baked->hash.basis);
+			}
+
+			if (placeKeys(baked, keys, keyCount))
+			{
+				return true;
+			}
+		}
+
+		free(baked->displacements);
+		free(baked->slots);
+
+		baked->slotCount <<= 1;
+	}
+
+	*baked = {};
+
+	return false;
+}
+
+static void freeBakedHash(BakedHash *baked)
+{
+	free(baked->displacements);
+	free(baked->slots);
+	*baked = {};
+}
+
+static void writeHash(FILE *file, char *name, BakedHash *baked)
+{
+	fprintf(file, "\nstatic constexpr u32 baked%sDisplacements[%u] =\n{", name, baked->bucketCount);
+
+	for (u32 i = 0; i < baked->bucketCount; ++i)
+	{
+		fprintf(file, "%s%u,", (i % 16) ? " " : "\n\t", baked->displacements[i]);
+	}
+
+	fprintf(file, "\n};\n\nstatic constexpr PerfectHashSlot baked%sSlots[%u] =\n{", name, baked->slotCount);
+
+	for (u32 i = 0; i < baked->slotCount; ++i)
+	{
+		PerfectHashSlot *slot = baked->slots + i;
+
+		fprintf(file, "%s{%u, %u, %d},", (i % 8) ? " " : "\n\t",
+				slot->keyOffset, slot->keyLength, slot->instructionIndex);
+	}
+
+	fprintf(file, "\n};\n\nstatic constexpr PerfectHash baked%sHash =\n"
+			"{\n\t%lluull, %u, %u, baked%sDisplacements, baked%sSlots\n};\n",
+			name, (unsigned long long) baked->hash.basis, baked->hash.bucketShift, baked->hash.slotShift, name, name);
+}
+
+static void writeHeader(FILE *file, char *configFile, InstructionTable *table,
+						BakedHash *extensionHash)
+{
+	fprintf(file,
+			"// Generated by bake_config from %s, do not edit.\n"
+			"// Only included by instruction_index.cpp.\n"
+			"#ifndef BAKED_CONFIG_H\n"
+			"#define BAKED_CONFIG_H\n", configFile);
+
+	// Strings are only made of printable characters, but the pool
+	// separates them with '\0'.
+	fprintf(file, "\nstatic constexpr u32 bakedStringsSize = %u;\n"
+			"static constexpr char bakedStrings[%u + 1] =\n\t\"", table->stringsSize, table->stringsSize);
+
+	// Lines of about 64 characters, cut after a string.
+	u32 lineStart = 0;
+
+	for (u32 i = 0; i < table->stringsSize; ++i)
+	{
+		char c = table->strings[i];
+
+		if (c == '\0')
+		{
+			fprintf(file, "\\000");
+
+			if ((i + 1 < table->stringsSize) &&
+				(i - lineStart >= 64))
+			{
+				fprintf(file, "\"\n\t\"");
+				lineStart = i + 1;
+			}
+		}
+		else if ((c == '"') || (c == '\\') || (c == '?'))
+		{
+			fprintf(file, "\\%c", c);
+		}
+		else if ((c < ' ') || (c > '~'))
+		{
+			fprintf(file, "\\%03o", (u8) c);
+		}
+		else
+		{
+			fputc(c, file);
+		}
+	}
+
+	fprintf(file, "\";\n");
+
+	// NOTE: Arrays get at least one element, empty ones are not valid.
+	fprintf(file, "\nstatic constexpr u32 bakedInstructionCount = %u;\n"
+			"static constexpr Instruction bakedInstructions[%u] =\n{",
+			table->instructionCount, table->instructionCount ? table->instructionCount : 1);
+
+	for (u32 i = 0; i < table->instructionCount; ++i)
+	{
+		Instruction *instruction = table->instructions + i;
+
+		fprintf(file, "\n\t{{%u, %u}, {%u, %u}, %u, %u},",
+				instruction->command.offset, instruction->command.length,
+				instruction->tag.offset, instruction->tag.length,
+				instruction->extensionFirst, instruction->extensionCount);
+	}
+
+	fprintf(file, "\n};\n\nstatic constexpr u32 bakedExtensionCount = %u;\n"
+			"static constexpr StringRef bakedExtensions[%u] =\n{",
+			table->extensionCount, table->extensionCount ? table->extensionCount : 1);
+
+	for (u32 i = 0; i < table->extensionCount; ++i)
+	{
+		fprintf(file, "%s{%u, %u},", (i % 8) ? " " : "\n\t",
+				table->extensions[i].offset, table->extensions[i].length);
+	}
+
+	fprintf(file, "\n};\n");
+
+	writeHash(file, "Extension", extensionHash);
+
+	fprintf(file, "\n#endif\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: bake_config CONFIG HEADER\n");
+		return 1;
+	}
+
+	char *configFile = argv[1];
+	char *headerFile = argv[2];
+
+	int configFd = open(configFile, O_RDONLY | O_CLOEXEC);
+	struct stat configStat;
+
+	if ((configFd == -1) ||
+		(fstat(configFd, &configStat) != 0))
+	{
+		fprintf(stderr, "bake_config: could not read config file '%s'.\n", configFile);
+		return 1;
+	}
+
+	// NOTE: Parsed like xopen does (errors are reported the same way),
+	//       then copied: the pool only has the strings used, interned.
+	InstructionTable parsed;
+	InstructionTable table;
+
+	makeInstructionsFromConfig(configFile, configFd, configStat.st_size, &parsed);
+	close(configFd);
+
+	copyInstructionTable(&table, &parsed);
+	freeInstructionTable(&parsed);
+
+	Key *keys = (Key *) malloc((table.extensionCount + 1) * sizeof(Key));
+	ASSERT(keys);
+
+	BakedHash extensionHash;
+
+	if (!bakeHash(&extensionHash, &table, keys, collectKeys(&table, keys)))
+	{
+		fprintf(stderr, "bake_config: %s: could not make a perfect hash of the config.\n", configFile);
+		return 1;
+	}
+
+	FILE *file = fopen(headerFile, "w");
+
+	if (!file)
+	{
+		fprintf(stderr, "bake_config: could not write '%s'.\n", headerFile);
+		return 1;
+	}
+
+	writeHeader(file, configFile, &table, &extensionHash);
+
+	if (fclose(file) != 0)
+	{
+		fprintf(stderr, "bake_config: could not write '%s'.\n", headerFile);
+		return 1;
+	}
+
+	fprintf(stderr, "bake_config: %s: %u instructions, %u extensions.\n",
+			configFile, table.instructionCount, table.extensionCount);
+
+	freeBakedHash(&extensionHash);
+	freeInstructionTable(&table);
+	free(keys);
+
+	return 0;
+}